@@ -0,0 +1,237 @@
+#ifndef AUGMENTED_PERCEPTION_DATASET_H
+#define AUGMENTED_PERCEPTION_DATASET_H
+
+// Bounding box datasets written by labelling_node (datasets/*.txt), read by
+// dataset_playback_node.
+//
+// The file is a frame id on a line of its own followed by one line per box:
+//   FRAME_ID
+//   BOX_X BOX_Y WIDTH HEIGHT LABEL ID
+// Lines that match neither (the header) are skipped.
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct DatasetBox
+{
+	int x;
+	int y;
+	int width;
+	int height;
+	int id;
+	int label;  // index in Dataset::labels()
+};
+
+// All the boxes in one contiguous array sorted by frame, plus a dense table
+// with the offset of the first box of every frame between the first and the
+// last frame of the file. Looking up a frame is two reads and never changes
+// the dataset, so playback does not allocate.
+class Dataset
+{
+public:
+	Dataset() : first_frame_(0)
+	{
+		offsets_.assign(1, 0);
+	}
+
+	// Parses the file in a single pass, false if it could not be read
+	bool load(const std::string &path)
+	{
+		std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+		if (!file)
+			return false;
+
+		std::ostringstream contents;
+		contents << file.rdbuf();
+		parse(contents.str());
+		return true;
+	}
+
+	void parse(const std::string &text)
+	{
+		boxes_.clear();
+		labels_.clear();
+		std::vector<unsigned int> frames;  // frame of every box, in file order
+
+		bool have_frame = false;
+		unsigned int frame = 0;
+		unsigned int min_frame = ~0u, max_frame = 0;
+
+		const char *p = text.data();
+		const char *end = p + text.size();
+		while (p < end)
+		{
+			const char *eol = std::find(p, end, '\n');
+
+			int values[5];
+			const char *label = NULL, *label_end = NULL;
+			int n = 0;
+			const char *q = p;
+			while (n < 4 && parseInt(q, eol, values[n]))
+				n++;
+			if (n == 4 && parseWord(q, eol, label, label_end) && parseInt(q, eol, values[4]))
+				n = 5;
+
+			if (n == 1 && atEnd(q, eol))  // Frame
+			{
+				frame = values[0];
+				have_frame = true;
+			}
+			else if (n == 5 && have_frame)  // BBox
+			{
+				DatasetBox box;
+				box.x = values[0];
+				box.y = values[1];
+				box.width = values[2];
+				box.height = values[3];
+				box.id = values[4];
+				box.label = intern(label, label_end);
+				boxes_.push_back(box);
+				frames.push_back(frame);
+				min_frame = std::min(min_frame, frame);
+				max_frame = std::max(max_frame, frame);
+			}
+
+			p = eol == end ? end : eol + 1;
+		}
+
+		if (boxes_.empty())
+		{
+			first_frame_ = 0;
+			offsets_.assign(1, 0);
+			return;
+		}
+
+		// Counting sort by frame, the boxes of a frame keep their file order
+		first_frame_ = min_frame;
+		offsets_.assign(max_frame - min_frame + 2, 0);
+		for (size_t i = 0; i < frames.size(); i++)
+			offsets_[frames[i] - first_frame_ + 1]++;
+		for (size_t f = 1; f < offsets_.size(); f++)
+			offsets_[f] += offsets_[f - 1];
+
+		std::vector<unsigned int> next(offsets_.begin(), offsets_.end() - 1);
+		std::vector<DatasetBox> sorted(boxes_.size());
+		for (size_t i = 0; i < boxes_.size(); i++)
+			sorted[next[frames[i] - first_frame_]++] = boxes_[i];
+		boxes_.swap(sorted);
+	}
+
+	// Boxes of the frame are [begin(frame), end(frame)), empty for unknown frames
+	const DatasetBox *begin(unsigned int frame) const
+	{
+		return boxes_.empty() ? NULL : &boxes_[0] + offsets_[index(frame)];
+	}
+
+	const DatasetBox *end(unsigned int frame) const
+	{
+		return boxes_.empty() ? NULL : &boxes_[0] + offsets_[index(frame) + (contains(frame) ? 1 : 0)];
+	}
+
+	size_t count(unsigned int frame) const
+	{
+		return end(frame) - begin(frame);
+	}
+
+	const std::string &label(int index) const
+	{
+		return labels_[index];
+	}
+
+	const std::vector<std::string> &labels() const
+	{
+		return labels_;
+	}
+
+	const std::vector<DatasetBox> &boxes() const
+	{
+		return boxes_;
+	}
+
+	unsigned int firstFrame() const
+	{
+		return first_frame_;
+	}
+
+	// One past the last frame with boxes
+	unsigned int endFrame() const
+	{
+		return first_frame_ + offsets_.size() - 1;
+	}
+
+private:
+	bool contains(unsigned int frame) const
+	{
+		return frame >= first_frame_ && frame - first_frame_ < offsets_.size() - 1;
+	}
+
+	size_t index(unsigned int frame) const
+	{
+		return contains(frame) ? frame - first_frame_ : 0;
+	}
+
+	static void skipBlanks(const char *&p, const char *end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+			p++;
+	}
+
+	static bool atEnd(const char *p, const char *end)
+	{
+		skipBlanks(p, end);
+		return p == end;
+	}
+
+	// Reads an integer in [p, end) and moves p past it, never crosses end
+	static bool parseInt(const char *&p, const char *end, int &value)
+	{
+		const char *q = p;
+		skipBlanks(q, end);
+		bool negative = q < end && *q == '-';
+		if (negative || (q < end && *q == '+'))
+			q++;
+		if (q == end || *q < '0' || *q > '9')
+			return false;
+
+		long v = 0;
+		while (q < end && *q >= '0' && *q <= '9')
+			v = v * 10 + (*q++ - '0');
+		if (q < end && *q != ' ' && *q != '\t' && *q != '\r')
+			return false;
+
+		value = negative ? -v : v;
+		p = q;
+		return true;
+	}
+
+	static bool parseWord(const char *&p, const char *end, const char *&word, const char *&word_end)
+	{
+		skipBlanks(p, end);
+		word = p;
+		while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+			p++;
+		word_end = p;
+		return word != word_end;
+	}
+
+	// A handful of labels per dataset, a linear search is enough
+	int intern(const char *label, const char *label_end)
+	{
+		size_t length = label_end - label;
+		for (size_t i = 0; i < labels_.size(); i++)
+			if (labels_[i].size() == length && std::equal(label, label_end, labels_[i].begin()))
+				return i;
+		labels_.push_back(std::string(label, label_end));
+		return labels_.size() - 1;
+	}
+
+	std::vector<DatasetBox> boxes_;
+	std::vector<unsigned int> offsets_;
+	std::vector<std::string> labels_;
+	unsigned int first_frame_;
+};
+
+#endif
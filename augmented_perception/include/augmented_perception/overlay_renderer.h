@@ -0,0 +1,141 @@
+#ifndef AUGMENTED_PERCEPTION_OVERLAY_RENDERER_H
+#define AUGMENTED_PERCEPTION_OVERLAY_RENDERER_H
+
+// Box overlays drawn on the camera views of dataset_playback_node and
+// labelling_node.
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+// Labels are registered once with their colour. The caption of every
+// label/ID pair ("car ID:3" on a box of the label colour) is rasterized the
+// first time it is drawn and copied onto the frame afterwards, and the box
+// outlines are four filled strips, so a crowded frame costs a few memcpy per
+// box instead of text layout and line rasterization.
+class OverlayRenderer
+{
+public:
+	// Returns the style of the label, the colour of an already known label is kept
+	int addStyle(const std::string &label, const cv::Scalar &colour)
+	{
+		for (size_t i = 0; i < styles_.size(); i++)
+			if (styles_[i].label == label)
+				return i;
+
+		Style style;
+		style.label = label;
+		style.colour = colour;
+		styles_.push_back(style);
+		return styles_.size() - 1;
+	}
+
+	const cv::Scalar &colour(int style) const
+	{
+		return styles_[style].colour;
+	}
+
+	// Outline of the box in the colour of the style, captioned with its label and id
+	void drawBox(cv::Mat &image, const cv::Rect &box, int style, int id, int thickness = 3)
+	{
+		drawFrame(image, box, styles_[style].colour, thickness);
+		blit(image, caption(style, id), cv::Point(box.x, box.y - kCaptionHeight));
+	}
+
+	// Outline of cv::rectangle(image, box.tl(), box.br(), colour, thickness), with square corners
+	static void drawFrame(cv::Mat &image, const cv::Rect &box, const cv::Scalar &colour, int thickness = 3)
+	{
+		int half = thickness / 2;
+		int x0 = box.x - half, x1 = box.x + box.width - half;
+		int y0 = box.y - half, y1 = box.y + box.height - half;
+		int length_x = box.width + thickness, length_y = box.height + thickness;
+
+		fill(image, cv::Rect(x0, y0, length_x, thickness), colour);
+		fill(image, cv::Rect(x0, y1, length_x, thickness), colour);
+		fill(image, cv::Rect(x0, y0, thickness, length_y), colour);
+		fill(image, cv::Rect(x1, y0, thickness, length_y), colour);
+	}
+
+	void clear()
+	{
+		captions_.clear();
+	}
+
+private:
+	enum { kCaptionHeight = 15, kDescent = 5, kMaxCaptions = 4096 };
+
+	struct Style
+	{
+		std::string label;
+		cv::Scalar colour;
+	};
+
+	// The caption box and the text of the labels, text pixels hanging below
+	// the box are only copied where the mask is set
+	struct Sprite
+	{
+		cv::Mat bgr;
+		cv::Mat mask;
+	};
+
+	const Sprite &caption(int style, int id)
+	{
+		std::pair<int, int> key(style, id);
+		std::map<std::pair<int, int>, Sprite>::iterator it = captions_.find(key);
+		if (it != captions_.end())
+			return it->second;
+
+		// Ids keep growing on long sequences
+		if (captions_.size() >= kMaxCaptions)
+			captions_.clear();
+
+		const Style &s = styles_[style];
+		std::ostringstream text;
+		text << s.label << " ID:" << id;
+
+		Sprite &sprite = captions_[key];
+		int width = s.label.length() * 12 + 60 + 1;
+		sprite.bgr.create(kCaptionHeight + kDescent, width, CV_8UC3);
+		sprite.bgr.setTo(cv::Scalar::all(0));
+		sprite.bgr.rowRange(0, kCaptionHeight + 1).setTo(s.colour);
+		cv::putText(sprite.bgr, text.str(), cv::Point(1, kCaptionHeight - 1), cv::FONT_HERSHEY_COMPLEX_SMALL, 0.8,
+					cv::Scalar(255, 255, 255), 1, CV_AA);
+
+		sprite.mask.create(sprite.bgr.size(), CV_8U);
+		sprite.mask.rowRange(0, kCaptionHeight + 1).setTo(cv::Scalar(255));
+		cv::Mat below = sprite.mask.rowRange(kCaptionHeight + 1, sprite.mask.rows);
+		cv::Mat gray;
+		cv::cvtColor(sprite.bgr.rowRange(kCaptionHeight + 1, sprite.bgr.rows), gray, cv::COLOR_BGR2GRAY);
+		cv::Mat(gray > 0).copyTo(below);
+		return sprite;
+	}
+
+	static void blit(cv::Mat &image, const Sprite &sprite, const cv::Point &at)
+	{
+		cv::Rect target = cv::Rect(at, sprite.bgr.size()) & cv::Rect(0, 0, image.cols, image.rows);
+		if (target.area() <= 0)
+			return;
+
+		cv::Rect source(target.tl() - at, target.size());
+		cv::Mat roi = image(target);
+		sprite.bgr(source).copyTo(roi, sprite.mask(source));
+	}
+
+	static void fill(cv::Mat &image, const cv::Rect &strip, const cv::Scalar &colour)
+	{
+		cv::Rect r = strip & cv::Rect(0, 0, image.cols, image.rows);
+		if (r.area() > 0)
+			image(r).setTo(colour);
+	}
+
+	std::vector<Style> styles_;
+	std::map<std::pair<int, int>, Sprite> captions_;
+};
+
+#endif
@@ -12,20 +12,31 @@
 #include <cmath>
 #include <iostream>
 
+#include "ball_segmentation/background_model.h"
+#include "ball_segmentation/hsv_segmentation.h"
+
 using namespace sensor_msgs;
 using namespace cv;
 using namespace std;
 
 image_transport::Publisher pub;
 
-// unsigned char *bg;
 unsigned char* input;
 
-cv::Mat bg;
+BackgroundModel background;
 cv::Mat click;
 cv_bridge::CvImagePtr cv_ptr;
 
 uchar hue = 2;
+HueSegmenter segmenter;
+MaskSupport support(2);
+cv::Mat mask;
+cv::Mat sub;
+// parts of sub and mask written on the previous frame, the only ones cleared
+cv::Rect sub_written;
+cv::Rect mask_written;
+// ball pixels (with full 5x5 support) needed to report and track the ball
+int min_ball_pixels = 400;
 int vibrance = 110;
 bool firstframe = true;
 bool paused = false;
@@ -33,137 +44,87 @@ bool paused = false;
 // rosparams
 bool using_rviz = false;
 
-int getH(int r, int g, int b)
+// Detector state. The lower half is searched until the ball is found, then only
+// a window around the position predicted by a constant velocity (alpha-beta)
+// filter. After max_misses frames without the ball the full search is resumed.
+struct BallTracker
 {
-  int max, min, delta;
-
-  if (r >= g && r >= b)
+  bool tracking;
+  int misses;
+  int max_misses;
+  Point2f position;
+  Point2f velocity;
+  Size2f size;
+
+  BallTracker() : tracking(false), misses(0), max_misses(5)
   {
-    max = r;
   }
 
-  if (g >= r && g >= b)
+  void reset()
   {
-    max = g;
+    tracking = false;
+    misses = 0;
+    velocity = Point2f(0, 0);
   }
 
-  if (b >= r && b >= g)
+  // region to process on the next frame, always inside search_area
+  Rect window(const Rect& search_area) const
   {
-    max = b;
-  }
+    if (!tracking)
+      return search_area;
 
-  if (r <= g && r <= b)
-  {
-    min = r;
-  }
+    Point2f predicted = position + velocity;
 
-  if (g <= r && g <= b)
-  {
-    min = g;
-  }
+    // the window grows with the speed and with every miss
+    float half_w = size.width * 0.75f + fabs(velocity.x) * 2 + 16 * (misses + 1);
+    float half_h = size.height * 0.75f + fabs(velocity.y) * 2 + 16 * (misses + 1);
 
-  if (b <= r && b <= g)
-  {
-    min = b;
-  }
+    Rect w = Rect(cvFloor(predicted.x - half_w), cvFloor(predicted.y - half_h), cvCeil(2 * half_w),
+                  cvCeil(2 * half_h)) & search_area;
 
-  delta = max - min;
+    if (w.area() == 0)
+      return search_area;
 
-  if (delta == 0)
-  {
-    return 0;
+    return w;
   }
 
-  int result;
-
-  if (max == r)
+  void found(const Point2f& measured, const Size2f& extent)
   {
-    result = (int)((60 / 1.41) * (fmod(((g - b) / (float)delta), 6))) % 256;
-  }
-
-  if (max == g)
-  {
-    result = (int)((60 / 1.41) * (((b - r) / (float)delta + 2))) % 256;
-  }
-
-  if (max == b)
-  {
-    result = (int)((60 / 1.41) * (((r - g) / (float)delta + 4))) % 256;
-  }
-
-  if (result < 0)
-  {
-    return 256 - result;
-  }
-  else
-    return result;
-}
+    const float alpha = 0.75f;
+    const float beta = 0.25f;
 
-int getS(int r, int g, int b)
-{
-  int max, min, delta;
-
-  if (r >= g && r >= b)
-  {
-    max = r;
-  }
-
-  if (g >= r && g >= b)
-  {
-    max = g;
-  }
-
-  if (b >= r && b >= g)
-  {
-    max = b;
-  }
-
-  if (r <= g && r <= b)
-  {
-    min = r;
-  }
+    if (!tracking)
+    {
+      position = measured;
+      velocity = Point2f(0, 0);
+      tracking = true;
+    }
+    else
+    {
+      Point2f predicted = position + velocity;
+      Point2f residual = measured - predicted;
 
-  if (g <= r && g <= b)
-  {
-    min = g;
-  }
+      position = predicted + residual * alpha;
+      velocity = velocity + residual * beta;
+    }
 
-  if (b <= r && b <= g)
-  {
-    min = b;
+    size = extent;
+    misses = 0;
   }
 
-  delta = max - min;
-
-  if (max == 0)
-  {
-    return 0;
-  }
-  else
+  void missed()
   {
-    return (int)((delta * 1.0 / max) * 255);
-  }
-}
-
-int getV(int r, int g, int b)
-{
-  int max, min, delta;
+    if (!tracking)
+      return;
 
-  if (r >= g && r >= b)
-  {
-    return r;
-  }
+    position += velocity;
 
-  if (g >= r && g >= b)
-  {
-    return g;
+    if (++misses > max_misses)
+      reset();
   }
+};
 
-  else
-  {  // if(b >= r && b >= g) {
-    return b;
-  }
-}
+BallTracker tracker;
 
 void mouseHandler(int event, int x, int y, int flags, void* param)
 {
@@ -214,155 +175,84 @@ void imageCallback(const sensor_msgs::ImageConstPtr& msg)
   if (firstframe || key == 32 /*spacebar*/)
   {  // define bg
     firstframe = false;
-    bg = image.clone();
-    cv::imshow("bg", bg);
-    blur(bg, bg, cv::Size(20, 20));
+    background.reset(image, image.rows / 2);
+    tracker.reset();
+    cv::imshow("bg", image);
     cv::waitKey(30);
   }
 
   if (key == 112)
     paused = !paused;  // P
 
-  // subtract BG
-  Mat sub = image - bg;
+  // only the lower half is searched, or a window around the ball when tracking
+  Rect lower_half(0, image.rows / 2, image.cols, image.rows - image.rows / 2);
+  Rect window = tracker.window(lower_half);
 
-  // up half ignore
-  for (int y = 0; y < sub.rows / 2; y++)
-  {
-    for (int x = 0; x < sub.cols; x++)
-    {
-      sub.at<Vec3b>(Point(x, y))[0] = 0;
-      sub.at<Vec3b>(Point(x, y))[1] = 0;
-      sub.at<Vec3b>(Point(x, y))[2] = 0;
-    }
-  }
+  // subtract BG, everything outside the window is ignored
+  background.subtract(image, sub, window, sub_written);
+  sub_written = window;
 
-  bool pointsToDelete[sub.rows / 2 * sub.cols] = { false };
   int meanX = 0;
   int meanY = 0;
   int boundX = 0;
   int boundY = 0;
   int cntBallPoint = 0;
+  int minX = window.x + window.width;
+  int maxX = window.x;
+  int minY = window.y + window.height;
+  int maxY = window.y;
 
-  uchar Hthreshold = 8;
-  uchar hmax = hue + Hthreshold;
-  uchar hmin = hue - Hthreshold;
+  // hue band +-8, pixels darker than 10 are ignored
+  segmenter.setHue(hue);
+  segmenter.segment(sub, mask, window, mask_written);
+  mask_written = window;
 
-  bool more_is_less = false;
-  if (hmax < hmin)
-  {
-    more_is_less = true;
-  }
+  // a pixel is kept only if its whole 5x5 neighbourhood is in band
+  support.compute(mask, window);
 
-  for (int y = sub.rows / 2; y < sub.rows; y++)
+  for (int y = window.y; y < window.y + window.height; y++)
   {
-    for (int x = 0; x < sub.cols; x++)
-    {
-      unsigned char b = sub.at<Vec3b>(Point(x, y))[0];
-      unsigned char g = sub.at<Vec3b>(Point(x, y))[1];
-      unsigned char r = sub.at<Vec3b>(Point(x, y))[2];
-
-      int h = getH(r, g, b);
-      int v = getV(r, g, b);
+    const uchar* in_band = mask.ptr<uchar>(y);
+    Vec3b* out = sub.ptr<Vec3b>(y);
 
-      if (v < 10)
+    for (int x = window.x; x < window.x + window.width; x++)
+    {
+      if (!in_band[x] || !support.full(x, y))
       {
-        sub.at<Vec3b>(Point(x, y))[0] = 0;
-        sub.at<Vec3b>(Point(x, y))[1] = 0;
-        sub.at<Vec3b>(Point(x, y))[2] = 0;
+        out[x] = Vec3b(0, 0, 0);
       }
       else
-      {
-        if (((h > (int)hmax && h < (int)hmin) && more_is_less) || ((h > (int)hmax || h < (int)hmin) && !more_is_less))
-        {
-          sub.at<Vec3b>(Point(x, y))[0] = 0;
-          sub.at<Vec3b>(Point(x, y))[1] = 0;
-          sub.at<Vec3b>(Point(x, y))[2] = 0;
-        }
-        else
-        {
-          sub.at<Vec3b>(Point(x, y))[0] = 255;
-          sub.at<Vec3b>(Point(x, y))[1] = 255;
-          sub.at<Vec3b>(Point(x, y))[2] = 255;
-
-          // detect if this points is to be black afterwards
-          int cnt = 0;
-
-          if (sub.at<Vec3b>(Point(x - 1, y))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x - 1, y - 1))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x, y - 1))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x + 1, y - 1))[0] == 255)
-            cnt++;
-
-          if (sub.at<Vec3b>(Point(x - 2, y))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x - 2, y - 1))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x + 2, y - 1))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x - 1, y - 2))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x, y - 2))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x + 1, y - 2))[0] == 255)
-            cnt++;
-
-          if (sub.at<Vec3b>(Point(x - 3, y))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x, y - 3))[0] == 255)
-            cnt++;
-
-          if (cnt < 12)
-          {
-            pointsToDelete[(y - sub.rows / 2) * sub.cols + x] = true;
-          }
-          else
-          {  // probably ball
-            boundX *= cntBallPoint;
-            boundY *= cntBallPoint;
-
-            cntBallPoint++;
-
-            meanX += x;
-            meanY += y;
-
-            boundX += x;
-            boundY += y;
-
-            boundX /= cntBallPoint;
-            boundY /= cntBallPoint;
-          }
-        }
-      }
-    }
-  }
+      {  // probably ball
+        out[x] = Vec3b(255, 255, 255);
 
-  // delete the points
-  for (int y = sub.rows / 2; y < sub.rows; y++)
-  {
-    for (int x = 0; x < sub.cols; x++)
-    {
-      if (y == cv_ptr->image.rows / 2)
-      {
-        sub.at<Vec3b>(Point(x, y))[0] = 0;
-        sub.at<Vec3b>(Point(x, y))[1] = 0;
-        sub.at<Vec3b>(Point(x, y))[2] = 0;
-      }
-      else if (pointsToDelete[(y - sub.rows / 2) * sub.cols + x] == 1)
-      {
-        sub.at<Vec3b>(Point(x, y))[0] = 0;
-        sub.at<Vec3b>(Point(x, y))[1] = 0;
-        sub.at<Vec3b>(Point(x, y))[2] = 0;
+        boundX *= cntBallPoint;
+        boundY *= cntBallPoint;
+
+        cntBallPoint++;
+
+        meanX += x;
+        meanY += y;
+
+        boundX += x;
+        boundY += y;
+
+        boundX /= cntBallPoint;
+        boundY /= cntBallPoint;
+
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
       }
     }
   }
 
+  // learn the background everywhere but on the ball colour
+  background.update(image, mask, window);
+
   // draw bounding circle
   // or bounding box
-  if (cntBallPoint > 100000)
+  if (cntBallPoint >= min_ball_pixels)
   {  // if ball detected
     meanX /= cntBallPoint;
     meanY /= cntBallPoint;
@@ -371,7 +261,20 @@ void imageCallback(const sensor_msgs::ImageConstPtr& msg)
     int pointx = (meanX - boundX) * 2 + boundX;
     int pointy = (meanY - boundY) * 2 + boundY;
     cv::rectangle(sub, Point(boundX, boundY), Point(pointx, pointy), Scalar(0, 255, 0), 3);
+
+    // the box may be drawn past the window, clear it on the next frame too
+    Rect box(Point(boundX, boundY), Point(pointx, pointy));
+    sub_written |= Rect(box.x - 2, box.y - 2, box.width + 5, box.height + 5);
+
+    tracker.found(Point2f(meanX, meanY), Size2f(maxX - minX + 1, maxY - minY + 1));
   }
+  else
+  {
+    tracker.missed();
+  }
+
+  if (window != lower_half)
+    cv::rectangle(sub, window, Scalar(255, 0, 0), 1);
 
   // Publish the data.
   cv_bridge::CvImage out_msg;
@@ -399,6 +302,18 @@ int main(int argc, char** argv)
     using_rviz = false;
   }
 
+  // 0 keeps the background captured on the first frame / spacebar,
+  // applied in steps of 1/256 (0.02 becomes 5/256)
+  double background_learning_rate;
+  nh.param("background_learning_rate", background_learning_rate, 0.02);
+  background.setLearningRate(background_learning_rate);
+
+  // smallest ball, in pixels whose whole 5x5 neighbourhood is in band
+  nh.param("min_ball_pixels", min_ball_pixels, min_ball_pixels);
+
+  // frames without the ball before going back to searching the whole lower half
+  nh.param("tracking_max_misses", tracker.max_misses, 5);
+
   cv::namedWindow("bg", CV_WINDOW_NORMAL);
   cv::startWindowThread();
 
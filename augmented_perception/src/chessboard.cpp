@@ -14,38 +14,310 @@ Notes:          Code generated with Visual Studio 2013 Intel OpenCV 2.4.8 librar
 #include <iostream>
 #include <vector>
 #include <ros/package.h>
+#include <ros/ros.h>
+#include <cv_bridge/cv_bridge.h>
+#include <sensor_msgs/Image.h>
 
 // OpenCV Includes
 #include <stdio.h>
+#include <sys/stat.h>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include <boost/bind.hpp>
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+
 using namespace std;
 
-// Function FindAndDisplayChessboard
-// find corners in a cheesboard with board_w x board_h dimensions
-// Display the corners in image and return number of detected corners
-int FindAndDisplayChessboard(cv::Mat image, int board_w, int board_h, std::vector<cv::Point2f> *corners) {
-	int board_size = board_w * board_h;
-	CvSize board_sz = cvSize(board_w, board_h);
+namespace po = boost::program_options;
 
-	cv::Mat grey_image;
+// One calibration image. The decoded image is only kept when it is shown
+struct CalibrationView {
+	string filename;
+	double mtime;
+	cv::Size size;
+	cv::Mat image;
+	std::vector<cv::Point2f> corners;
+	bool found;
+	bool cached;
+};
+
+struct DetectionOptions {
+	int board_w;
+	int board_h;
+	double scale;    // detection runs on the image scaled by this factor
+	bool retry_full; // search the full image when the scaled one fails
+	bool keep_images;
+};
+
+double modificationTime(const string &filename) {
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+		return -1;
+	return st.st_mtime;
+}
 
+// Function FindCorners
+// find corners in a cheesboard with board_w x board_h dimensions on a downscaled
+// copy of the grey image and return if all were found
+bool FindCorners(const cv::Mat &grey_image, std::vector<cv::Point2f> &corners, const DetectionOptions &options) {
+	cv::Size board_sz(options.board_w, options.board_h);
+
+	int flags = cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_NORMALIZE_IMAGE | cv::CALIB_CB_FAST_CHECK;
+	bool found = false;
+	if (options.scale < 1.0) {
+		cv::Mat small;
+		cv::resize(grey_image, small, cv::Size(), options.scale, options.scale, cv::INTER_AREA);
+		found = cv::findChessboardCorners(small, board_sz, corners, flags);
+		for (size_t c = 0; c < corners.size(); c++)
+			corners[c] *= 1.0 / options.scale;
+	}
+	// Small boards may vanish in the downscaled image
+	if (!found && (options.retry_full || options.scale >= 1.0))
+		found = cv::findChessboardCorners(grey_image, board_sz, corners, flags);
+	return found;
+}
+
+// Refine at full resolution, the search window covers the downscaling error
+void RefineCorners(const cv::Mat &grey_image, std::vector<cv::Point2f> &corners, const DetectionOptions &options) {
+	int window = std::max(5, (int) ceil(2.0 / options.scale));
+	cv::cornerSubPix(grey_image, corners, cv::Size(window, window), cv::Size(-1, -1),
+					 cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 30, 0.01));
+}
+
+// Function FindChessboard
+// load the image of the view and find its corners
+bool FindChessboard(CalibrationView &view, const DetectionOptions &options) {
+	cv::Mat image = cv::imread(view.filename, CV_LOAD_IMAGE_COLOR);
+	if (!image.data) {
+		printf("\nCould not load image file: %s", view.filename.c_str());
+		view.found = false;
+		return false;
+	}
+	view.size = image.size();
+	if (options.keep_images)
+		view.image = image;
+
+	cv::Mat grey_image;
 	cv::cvtColor(image, grey_image, CV_BGR2GRAY);
 
-	// find chessboard corners
-	bool found = cv::findChessboardCorners(grey_image, board_sz, *corners, 0);
+	view.found = FindCorners(grey_image, view.corners, options);
+	if (view.found)
+		RefineCorners(grey_image, view.corners, options);
+	return view.found;
+}
+
+// Images are taken by the threads in turn, each image is processed once
+void DetectWorker(std::vector<CalibrationView> *views, const DetectionOptions *options, int *next,
+				  boost::mutex *mutex) {
+	while (true) {
+		int i;
+		{
+			boost::lock_guard<boost::mutex> lock(*mutex);
+			i = (*next)++;
+		}
+		if (i >= (int) views->size())
+			return;
+		if (!(*views)[i].cached)
+			FindChessboard((*views)[i], *options);
+	}
+}
+
+// The corners are kept with the modification time of every image, so a new run
+// only processes the images that changed
+void LoadCache(const string &path, const DetectionOptions &options, std::vector<CalibrationView> &views) {
+	cv::FileStorage fs(path, cv::FileStorage::READ);
+	if (!fs.isOpened())
+		return;
+	if ((int) fs["board_w"] != options.board_w || (int) fs["board_h"] != options.board_h)
+		return;
+
+	cv::FileNode images = fs["images"];
+	for (cv::FileNodeIterator it = images.begin(); it != images.end(); ++it) {
+		string filename = (string) (*it)["file"];
+		for (size_t i = 0; i < views.size(); i++) {
+			CalibrationView &view = views[i];
+			if (view.filename != filename || view.mtime < 0 || view.mtime != (double) (*it)["mtime"])
+				continue;
+			view.size = cv::Size((int) (*it)["width"], (int) (*it)["height"]);
+			view.found = (int) (*it)["found"] != 0;
+			(*it)["corners"] >> view.corners;
+			view.cached = !view.found || view.corners.size() == (size_t) (options.board_w * options.board_h);
+		}
+	}
+}
+
+void SaveCache(const string &path, const DetectionOptions &options, const std::vector<CalibrationView> &views) {
+	cv::FileStorage fs(path, cv::FileStorage::WRITE);
+	if (!fs.isOpened()) {
+		printf("\nCould not write %s", path.c_str());
+		return;
+	}
+	fs << "board_w" << options.board_w << "board_h" << options.board_h;
+	fs << "images" << "[";
+	for (size_t i = 0; i < views.size(); i++) {
+		const CalibrationView &view = views[i];
+		if (view.size.area() == 0)
+			continue;
+		fs << "{" << "file" << view.filename << "mtime" << view.mtime << "width" << view.size.width
+		   << "height" << view.size.height << "found" << (int) view.found << "corners" << view.corners << "}";
+	}
+	fs << "]";
+}
+
+// Keeps the frames of a video worth calibrating with: the ones that put board
+// corners on cells of the image no kept frame covers yet, or that show the board
+// in a pose (position, size and tilt) different enough from all the kept ones.
+// Only the coarse search runs on every frame, the corners of the kept frames are
+// refined. The number of kept frames, and so the solver time, is bounded.
+class FrameSelector {
+public:
+	FrameSelector(const DetectionOptions &options, int target, int grid_w, double min_distance)
+			: options_(options), target_(target), grid_w_(grid_w), grid_h_(1), min_distance_(min_distance),
+			  frames_(0), boards_(0) {}
+
+	// Returns if the frame was kept
+	bool add(const cv::Mat &image) {
+		frames_++;
+		if (full())
+			return false;
+
+		// The grid rows follow the aspect of the images
+		if (coverage_.empty()) {
+			grid_h_ = std::max((int) round(grid_w_ * (double) image.rows / image.cols), 1);
+			coverage_.assign(grid_w_ * grid_h_, 0);
+		}
+
+		cv::Mat grey_image;
+		cv::cvtColor(image, grey_image, CV_BGR2GRAY);
+
+		CalibrationView view;
+		if (!FindCorners(grey_image, view.corners, options_))
+			return false;
+		boards_++;
+
+		std::vector<int> cells;
+		for (size_t c = 0; c < view.corners.size(); c++) {
+			int gx = std::min(std::max((int) (view.corners[c].x * grid_w_ / image.cols), 0), grid_w_ - 1);
+			int gy = std::min(std::max((int) (view.corners[c].y * grid_h_ / image.rows), 0), grid_h_ - 1);
+			cells.push_back(gy * grid_w_ + gx);
+		}
+		std::sort(cells.begin(), cells.end());
+		cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+
+		int new_cells = 0;
+		for (size_t c = 0; c < cells.size(); c++)
+			if (coverage_[cells[c]] == 0)
+				new_cells++;
+
+		Pose pose = boardPose(view.corners, image.size());
+		double distance = 1e9;
+		for (size_t p = 0; p < poses_.size(); p++)
+			distance = std::min(distance, pose.distance(poses_[p]));
+
+		if (new_cells == 0 && distance < min_distance_)
+			return false;
+
+		RefineCorners(grey_image, view.corners, options_);
+		view.found = true;
+		view.cached = false;
+		view.mtime = -1;
+		view.size = image.size();
+		if (options_.keep_images)
+			view.image = image.clone();
+		char name[32];
+		snprintf(name, sizeof(name), "frame %d", frames_);
+		view.filename = name;
+
+		views_.push_back(view);
+		poses_.push_back(pose);
+		for (size_t c = 0; c < cells.size(); c++)
+			coverage_[cells[c]]++;
+		return true;
+	}
+
+	bool full() const { return (int) views_.size() >= target_; }
+
+	// Fraction of the grid cells with corners
+	double coverage() const {
+		if (coverage_.empty())
+			return 0;
+		return (double) (coverage_.size() - std::count(coverage_.begin(), coverage_.end(), 0)) / coverage_.size();
+	}
+
+	int frames() const { return frames_; }
 
-	// Draw results
-	if (true) {
-		cv::drawChessboardCorners(image, board_sz, cv::Mat(*corners), found);
-		cv::imshow("Calibration", image);
-		printf("\n Number of corners: %lu", corners->size());
-		cv::waitKey(0);
+	int boards() const { return boards_; }
+
+	const std::vector<CalibrationView> &views() const { return views_; }
+
+private:
+	// Board centre and size relative to the image, and tilt from the ratio of
+	// the lengths of its opposite edges
+	struct Pose {
+		double x, y, size, skew_x, skew_y;
+
+		double distance(const Pose &other) const {
+			return fabs(x - other.x) + fabs(y - other.y) + fabs(size - other.size) + fabs(skew_x - other.skew_x) +
+				   fabs(skew_y - other.skew_y);
+		}
+	};
+
+	Pose boardPose(const std::vector<cv::Point2f> &corners, const cv::Size &size) const {
+		int w = options_.board_w, h = options_.board_h;
+		cv::Point2f quad[4] = {corners[0], corners[w - 1], corners[w * h - 1], corners[w * (h - 1)]};
+
+		cv::Point2f centre(0, 0);
+		for (size_t c = 0; c < corners.size(); c++)
+			centre += corners[c];
+		centre *= 1.0 / corners.size();
+
+		double area = 0;
+		for (int k = 0; k < 4; k++)
+			area += quad[k].x * quad[(k + 1) % 4].y - quad[(k + 1) % 4].x * quad[k].y;
+
+		Pose pose;
+		pose.x = centre.x / size.width;
+		pose.y = centre.y / size.height;
+		pose.size = sqrt(fabs(area) / 2 / size.area());
+		pose.skew_x = log(std::max(cv::norm(quad[1] - quad[2]), 1.0) / std::max(cv::norm(quad[0] - quad[3]), 1.0));
+		pose.skew_y = log(std::max(cv::norm(quad[0] - quad[1]), 1.0) / std::max(cv::norm(quad[3] - quad[2]), 1.0));
+		return pose;
+	}
+
+	DetectionOptions options_;
+	int target_;
+	int grid_w_;
+	int grid_h_;
+	double min_distance_;
+	int frames_;
+	int boards_;
+	std::vector<int> coverage_;  // corners of the kept frames in every cell
+	std::vector<Pose> poses_;
+	std::vector<CalibrationView> views_;
+};
+
+void SelectorCallback(FrameSelector *selector, bool show, const sensor_msgs::ImageConstPtr &msg) {
+	cv_bridge::CvImageConstPtr cv_ptr;
+	try {
+		cv_ptr = cv_bridge::toCvShare(msg, sensor_msgs::image_encodings::BGR8);
+	}
+	catch (cv_bridge::Exception &e) {
+		ROS_ERROR("Could not convert from '%s' to 'bgr8'.", msg->encoding.c_str());
+		return;
+	}
+
+	if (selector->add(cv_ptr->image))
+		ROS_INFO("Kept frame %d, %lu kept of %d with the board, %.0f%% of the image covered",
+				 selector->frames(), selector->views().size(), selector->boards(), 100 * selector->coverage());
+
+	if (show) {
+		cv::imshow("Calibration", cv_ptr->image);
+		cv::waitKey(1);
 	}
-	return corners->size();
 }
 
 std::vector < cv::Point3f > Generate3DPoints ( int size )
@@ -68,20 +340,65 @@ int main(int argc, char **argv) {
 	int board_w = 9;
 	int board_h = 6;
 
+	po::options_description desc("Allowed options");
+	desc.add_options()
+			("help,h", "produce help message")
+			("batch,b", "calibrate without showing any window")
+			("images,n", po::value<int>()->default_value(n_boards), "number of images")
+			("pattern,p", po::value<string>()->default_value("images/left%02d.jpg"),
+			 "printf pattern of the image files, numbered from 1, relative to the package")
+			("board-width", po::value<int>()->default_value(board_w), "inner corners along the board width")
+			("board-height", po::value<int>()->default_value(board_h), "inner corners along the board height")
+			("scale,s", po::value<double>()->default_value(0.5), "scale of the images the corners are searched on")
+			("threads,j", po::value<int>()->default_value(boost::thread::hardware_concurrency()),
+			 "number of images processed at once")
+			("no-cache", "detect the corners of every image again")
+			("topic,t", po::value<string>(), "select the frames of this camera topic instead of reading images")
+			("target", po::value<int>()->default_value(40), "number of frames selected from the topic")
+			("grid", po::value<int>()->default_value(8), "columns of the coverage grid, rows follow the image aspect")
+			("pose-distance", po::value<double>()->default_value(0.2),
+			 "pose change that makes a frame without new coverage worth keeping");
+
+	// Remapping arguments (image:=..., __name:=...) are left to ros::init in the topic mode
+	std::vector<string> args;
+	ros::removeROSArgs(argc, argv, args);
+	args.erase(args.begin());
+
+	po::variables_map vm;
+	try {
+		po::store(po::command_line_parser(args).options(desc).run(), vm);
+	} catch (po::error &e) {
+		cout << e.what() << endl << desc << endl;
+		return 1;
+	}
+	if (vm.count("help")) {
+		cout << desc << endl;
+		return 0;
+	}
+
+	bool batch = vm.count("batch");
+	n_boards = vm["images"].as<int>();
+	board_w = vm["board-width"].as<int>();
+	board_h = vm["board-height"].as<int>();
+	int threads = std::max(vm["threads"].as<int>(), 1);
+
+	DetectionOptions options;
+	options.board_w = board_w;
+	options.board_h = board_h;
+	options.scale = std::min(std::max(vm["scale"].as<double>(), 0.05), 1.0);
+	options.retry_full = true;
+	options.keep_images = !batch;
+
 	int board_sz = board_w * board_h;
 
 	char filename[200];
+	string package = ros::package::getPath("augmented_perception");
+	string pattern = package + "/" + vm["pattern"].as<string>();
 
 	// Chessboard coordinates and image pixels
 	std::vector<std::vector<cv::Point3f> > object_points;
 	std::vector<std::vector<cv::Point2f> > image_points;
 
-	// Corners detected in each image
-	std::vector<cv::Point2f> corners;
-
-	int corner_count;
-
-	cv::Mat image;
 	int i;
 
 	int sucesses = 0;
@@ -91,56 +408,111 @@ int main(int argc, char **argv) {
 	for (int j = 0; j < board_sz; j++)
 		obj.push_back(cv::Point3f(float(j / board_w), float(j % board_w), 0.0));
 
-	for (i = 0; i < n_boards; i++) {
-		// read image
-		sprintf(filename, (ros::package::getPath("augmented_perception") + "/images/left%02d.jpg").c_str(), i + 1);
-		printf("\nReading %s", filename);
-		image = cv::imread(filename, CV_LOAD_IMAGE_COLOR);
-
-		if (!image.data) {
-			printf("\nCould not load image file: %s\n", filename);
-			getchar();
-			return 0;
+	std::vector<CalibrationView> views;
+	if (vm.count("topic")) {
+		// Only the coarse search runs on every frame of the stream
+		options.retry_full = false;
+
+		ros::init(argc, argv, "chessboard");
+		ros::NodeHandle nh;
+		FrameSelector selector(options, vm["target"].as<int>(), std::max(vm["grid"].as<int>(), 1),
+							   vm["pose-distance"].as<double>());
+		ros::Subscriber sub = nh.subscribe<sensor_msgs::Image>(vm["topic"].as<string>(), 1,
+															   boost::bind(SelectorCallback, &selector, !batch, _1));
+		ros::Rate rate(100);
+		while (ros::ok() && !selector.full()) {
+			ros::spinOnce();
+			rate.sleep();
+		}
+		sub.shutdown();
+
+		views = selector.views();
+		n_boards = views.size();
+	} else {
+		views.resize(n_boards);
+		for (i = 0; i < n_boards; i++) {
+			snprintf(filename, sizeof(filename), pattern.c_str(), i + 1);
+			views[i].filename = filename;
+			views[i].mtime = modificationTime(filename);
+			views[i].found = false;
+			views[i].cached = false;
 		}
 
-		// find and display corners
-		corner_count = FindAndDisplayChessboard(image, board_w, board_h, &corners);
+		// The cache holds no images, the ones to show are detected again
+		string cache_path = pattern.substr(0, pattern.rfind('/')) + "/chessboard_corners.yml";
+		if (batch && !vm.count("no-cache"))
+			LoadCache(cache_path, options, views);
+
+		// find corners, the images are spread over the threads
+		boost::mutex mutex;
+		int next = 0;
+		boost::thread_group workers;
+		for (int t = 1; t < threads; t++)
+			workers.create_thread(boost::bind(DetectWorker, &views, &options, &next, &mutex));
+		DetectWorker(&views, &options, &next, &mutex);
+		workers.join_all();
+
+		SaveCache(cache_path, options, views);
+	}
+
+	// images used for the calibration
+	std::vector<int> calibrated;
+	cv::Size image_size;
+	for (i = 0; i < n_boards; i++) {
+		CalibrationView &view = views[i];
+		printf("\n%s: %lu corners%s", view.filename.c_str(), view.corners.size(), view.cached ? " (cached)" : "");
+
+		if (!batch && view.image.data) {
+			cv::Mat shown = view.image.clone();
+			cv::drawChessboardCorners(shown, cv::Size(board_w, board_h), cv::Mat(view.corners), view.found);
+			cv::imshow("Calibration", shown);
+			cv::waitKey(0);
+		}
 
-		if (corner_count == board_w * board_h) {
-			image_points.push_back(corners);
+		if (view.found && (int) view.corners.size() == board_sz) {
+			image_points.push_back(view.corners);
 			object_points.push_back(obj);
+			calibrated.push_back(i);
+			image_size = view.size;
 			sucesses++;
 		}
 	}
+	printf("\n%d of %d images with the whole board\n", sucesses, n_boards);
+
+	if (sucesses == 0)
+		return 1;
 
 	cv::Mat intrinsic_matrix = cv::Mat(3, 3, CV_32FC1);
 	cv::Mat distortion_coeffs;
 	std::vector<cv::Mat> rotation_vectors;
 	std::vector<cv::Mat> translation_vectors;
 
-	calibrateCamera ( object_points, image_points, image.size (), intrinsic_matrix, distortion_coeffs, rotation_vectors, translation_vectors );
+	double rms = calibrateCamera ( object_points, image_points, image_size, intrinsic_matrix, distortion_coeffs, rotation_vectors, translation_vectors );
+
+	std::cout << std::endl << "Reprojection error = " << rms << std::endl;
 
 	std::cout << std::endl << "Intrinsics = "<< std::endl << " " << intrinsic_matrix << std::endl;
 
 	std::cout << std::endl << "Distortion = "<< std::endl << " " << distortion_coeffs << std::endl;
 
+	if (batch)
+		return 0;
 
 	cout << distortion_coeffs.ptr(0,0) << endl;
 
 	std::cout << std::endl << "Translations = "<< std::endl ;
-	for (i=0;i<n_boards;i++)
+	for (i=0;i<sucesses;i++)
 		std::cout << translation_vectors.at(i) << std::endl;
 
 	std::cout << std::endl << "Rotations= "<< std::endl ;
-	for (i=0;i<n_boards;i++)
+	for (i=0;i<sucesses;i++)
 		std::cout << rotation_vectors.at(i) << std::endl;
 
-	for ( i = 0; i < n_boards; i++ )
+	for ( i = 0; i < sucesses; i++ )
 	{
-		// read image
-		sprintf(filename, (ros::package::getPath("augmented_perception") + "/images/left%02d.jpg").c_str(), i + 1);
-		std::cout << "\n" << "Reading : " << filename << "\n";
-		image = cv::imread ( filename, CV_LOAD_IMAGE_COLOR );
+		// image kept from the detection
+		cv::Mat image = views[calibrated[i]].image;
+		std::cout << "\n" << "Showing : " << views[calibrated[i]].filename << "\n";
 		// create cube points
 		std::vector < cv::Point3f > o_points = Generate3DPoints ( 3 );
 		// position cube
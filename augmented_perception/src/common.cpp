@@ -2,6 +2,8 @@
 #include "mtt/mtt.h"
 #include "mtt/mtt_clustering.h"
 
+#include "ball_segmentation/hsv_segmentation.h"
+
 void PointCloud2ToData(sensor_msgs::PointCloud2 &cloud, t_data &data)  // this function will convert the point cloud
 // data into a laser scan type structure
 {
@@ -1725,135 +1727,3 @@ void CreateMarkersSug(vector<visualization_msgs::Marker> &marker_vector, mtt::Ta
 		marker_vector.push_back(it->second.first);
 	}
 }
-
-int getH(int r, int g, int b)
-{
-	int max, min, delta;
-
-	if (r >= g && r >= b)
-	{
-		max = r;
-	}
-
-	if (g >= r && g >= b)
-	{
-		max = g;
-	}
-
-	if (b >= r && b >= g)
-	{
-		max = b;
-	}
-
-	if (r <= g && r <= b)
-	{
-		min = r;
-	}
-
-	if (g <= r && g <= b)
-	{
-		min = g;
-	}
-
-	if (b <= r && b <= g)
-	{
-		min = b;
-	}
-
-	delta = max - min;
-
-	if (delta == 0)
-	{
-		return 0;
-	}
-
-	int result;
-
-	if (max == r)
-	{
-		result = (int)((60 / 1.41) * (fmod(((g - b) / (float)delta), 6))) % 256;
-	}
-
-	if (max == g)
-	{
-		result = (int)((60 / 1.41) * (((b - r) / (float)delta + 2))) % 256;
-	}
-
-	if (max == b)
-	{
-		result = (int)((60 / 1.41) * (((r - g) / (float)delta + 4))) % 256;
-	}
-
-	if (result < 0)
-	{
-		return 256 - result;
-	}
-	else
-		return result;
-}
-
-int getS(int r, int g, int b)
-{
-	int max, min, delta;
-
-	if (r >= g && r >= b)
-	{
-		max = r;
-	}
-
-	if (g >= r && g >= b)
-	{
-		max = g;
-	}
-
-	if (b >= r && b >= g)
-	{
-		max = b;
-	}
-
-	if (r <= g && r <= b)
-	{
-		min = r;
-	}
-
-	if (g <= r && g <= b)
-	{
-		min = g;
-	}
-
-	if (b <= r && b <= g)
-	{
-		min = b;
-	}
-
-	delta = max - min;
-
-	if (max == 0)
-	{
-		return 0;
-	}
-	else
-	{
-		return (int)((delta * 1.0 / max) * 255);
-	}
-}
-
-int getV(int r, int g, int b)
-{
-	int max, min, delta;
-
-	if (r >= g && r >= b)
-	{
-		return r;
-	}
-
-	if (g >= r && g >= b)
-	{
-		return g;
-	}
-
-	else
-	{  // if(b >= r && b >= g) {
-		return b;
-	}
-}
\ No newline at end of file
@@ -0,0 +1,377 @@
+#include <cv_bridge/cv_bridge.h>
+
+#include <ros/package.h>
+#include <ros/ros.h>
+
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/Image.h>
+
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+
+#include <sys/stat.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "augmented_perception/dataset.h"
+
+// Offline export of a labelled drive: reads the bag and its dataset file
+// together and writes, in the output directory,
+//   image_2/FRAME.png        the labelled frames
+//   label_2/FRAME.txt        KITTI object labels of every frame
+//   crops/LABEL/FRAME_ID.bmp the object crops
+//   annotations.json         COCO annotations of all the frames
+// The bag is read on the main thread, converting the frames and writing the
+// files is shared by a pool of threads.
+
+using namespace std;
+using namespace cv;
+
+namespace po = boost::program_options;
+
+#define foreach BOOST_FOREACH
+
+struct ExportOptions {
+	string bag;
+	string dataset;
+	string topic;
+	string output;
+	int threads;
+	bool frames;
+	bool crops;
+};
+
+// COCO annotations are numbered once all the frames are done, in frame order
+struct FrameResult {
+	unsigned int frame;
+	int width;
+	int height;
+	vector<pair<int, Rect> > boxes;  // category and box
+	vector<int> ids;
+
+	bool operator<(const FrameResult &other) const { return frame < other.frame; }
+};
+
+void makeDirectory(const string &path) {
+	mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+}
+
+string frameName(unsigned int frame) {
+	char name[16];
+	snprintf(name, sizeof(name), "%06u", frame);
+	return name;
+}
+
+string jsonString(const string &text) {
+	string quoted = "\"";
+	for (size_t i = 0; i < text.size(); i++) {
+		if (text[i] == '"' || text[i] == '\\')
+			quoted += '\\';
+		quoted += text[i];
+	}
+	return quoted + "\"";
+}
+
+class DatasetExporter {
+public:
+	DatasetExporter(const ExportOptions &options, const Dataset &dataset)
+			: options_(options), dataset_(dataset), done_(false), frames_(0), objects_(0) {
+		makeDirectory(options_.output);
+		makeDirectory(options_.output + "/label_2");
+		if (options_.frames)
+			makeDirectory(options_.output + "/image_2");
+		if (options_.crops)
+			makeDirectory(options_.output + "/crops");
+
+		// COCO categories skip the regions marked DontCare
+		for (size_t l = 0; l < dataset_.labels().size(); l++) {
+			if (dataset_.label(l) == "DontCare") {
+				categories_.push_back(-1);
+				continue;
+			}
+			categories_.push_back(category_names_.size());
+			category_names_.push_back(dataset_.label(l));
+			if (options_.crops)
+				makeDirectory(options_.output + "/crops/" + dataset_.label(l));
+		}
+
+		max_queue_ = 2 * options_.threads;
+		for (int i = 0; i < options_.threads; i++)
+			workers_.create_thread(boost::bind(&DatasetExporter::work, this));
+	}
+
+	~DatasetExporter() { finish(); }
+
+	// Blocks while the workers are busy, so only a few frames are held at once
+	void push(const sensor_msgs::Image::ConstPtr &msg) {
+		boost::unique_lock<boost::mutex> lock(mutex_);
+		while (queue_.size() >= max_queue_)
+			not_full_.wait(lock);
+		queue_.push_back(msg);
+		not_empty_.notify_one();
+	}
+
+	void finish() {
+		{
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			if (done_)
+				return;
+			done_ = true;
+		}
+		not_empty_.notify_all();
+		workers_.join_all();
+	}
+
+	int frames() const { return frames_; }
+
+	int objects() const { return objects_; }
+
+	bool writeCoco(const string &path) {
+		FILE *file = fopen(path.c_str(), "w");
+		if (!file)
+			return false;
+
+		std::sort(results_.begin(), results_.end());
+
+		fprintf(file, "{\n\"info\": {\"description\": %s},\n", jsonString(options_.dataset).c_str());
+		fprintf(file, "\"images\": [");
+		for (size_t i = 0; i < results_.size(); i++) {
+			const FrameResult &r = results_[i];
+			fprintf(file, "%s\n{\"id\": %u, \"file_name\": %s, \"width\": %d, \"height\": %d}", i ? "," : "",
+					r.frame, jsonString("image_2/" + frameName(r.frame) + ".png").c_str(), r.width, r.height);
+		}
+		fprintf(file, "\n],\n\"annotations\": [");
+		int id = 0;
+		for (size_t i = 0; i < results_.size(); i++) {
+			const FrameResult &r = results_[i];
+			for (size_t b = 0; b < r.boxes.size(); b++) {
+				const Rect &box = r.boxes[b].second;
+				fprintf(file, "%s\n{\"id\": %d, \"image_id\": %u, \"category_id\": %d, \"bbox\": [%d, %d, %d, %d], "
+							  "\"area\": %d, \"iscrowd\": 0, \"track_id\": %d}",
+						id ? "," : "", id + 1, r.frame, r.boxes[b].first + 1, box.x, box.y, box.width, box.height,
+						box.area(), r.ids[b]);
+				id++;
+			}
+		}
+		fprintf(file, "\n],\n\"categories\": [");
+		for (size_t c = 0; c < category_names_.size(); c++)
+			fprintf(file, "%s\n{\"id\": %d, \"name\": %s}", c ? "," : "", (int) c + 1,
+					jsonString(category_names_[c]).c_str());
+		fprintf(file, "\n]\n}\n");
+
+		return fclose(file) == 0;
+	}
+
+private:
+	void work() {
+		while (true) {
+			sensor_msgs::Image::ConstPtr msg;
+			{
+				boost::unique_lock<boost::mutex> lock(mutex_);
+				while (queue_.empty() && !done_)
+					not_empty_.wait(lock);
+				if (queue_.empty())
+					return;
+				msg = queue_.front();
+				queue_.pop_front();
+				not_full_.notify_one();
+			}
+			exportFrame(msg);
+		}
+	}
+
+	void exportFrame(const sensor_msgs::Image::ConstPtr &msg) {
+		unsigned int frame = msg->header.seq;
+		string name = frameName(frame);
+
+		cv_bridge::CvImageConstPtr cv_ptr;
+		try {
+			cv_ptr = cv_bridge::toCvCopy(msg, sensor_msgs::image_encodings::BGR8);
+		}
+		catch (cv_bridge::Exception &e) {
+			ROS_ERROR("Could not convert frame %u from '%s' to 'bgr8'.", frame, msg->encoding.c_str());
+			return;
+		}
+		const Mat &image = cv_ptr->image;
+		Rect bounds(0, 0, image.cols, image.rows);
+
+		if (options_.frames)
+			imwrite(options_.output + "/image_2/" + name + ".png", image);
+
+		FrameResult result;
+		result.frame = frame;
+		result.width = image.cols;
+		result.height = image.rows;
+
+		string label_path = options_.output + "/label_2/" + name + ".txt";
+		FILE *labels = fopen(label_path.c_str(), "w");
+		if (!labels) {
+			ROS_ERROR("Could not write %s", label_path.c_str());
+			return;
+		}
+
+		for (const DatasetBox *box = dataset_.begin(frame); box != dataset_.end(frame); box++) {
+			Rect full(box->x, box->y, box->width, box->height);
+			Rect visible = full & bounds;
+			if (visible.area() <= 0)
+				continue;
+
+			// KITTI: type truncated occluded alpha bbox(4) dimensions(3) location(3) rotation_y,
+			// the 3D fields are unknown
+			double truncated = full.area() > 0 ? 1.0 - (double) visible.area() / full.area() : 0.0;
+			fprintf(labels, "%s %.2f 0 -10 %.2f %.2f %.2f %.2f -1 -1 -1 -1000 -1000 -1000 -10\n",
+					dataset_.label(box->label).c_str(), truncated, (double) visible.x, (double) visible.y,
+					(double) (visible.x + visible.width), (double) (visible.y + visible.height));
+
+			int category = categories_[box->label];
+			if (category < 0)
+				continue;
+
+			result.boxes.push_back(make_pair(category, visible));
+			result.ids.push_back(box->id);
+
+			if (options_.crops) {
+				char crop_name[32];
+				snprintf(crop_name, sizeof(crop_name), "_%d.bmp", box->id);
+				imwrite(options_.output + "/crops/" + dataset_.label(box->label) + "/" + name + crop_name,
+						image(visible));
+			}
+		}
+		fclose(labels);
+
+		boost::lock_guard<boost::mutex> lock(mutex_);
+		frames_++;
+		objects_ += result.boxes.size();
+		results_.push_back(result);
+	}
+
+	ExportOptions options_;
+	const Dataset &dataset_;
+	vector<int> categories_;  // COCO category of every dataset label, -1 for DontCare
+	vector<string> category_names_;
+
+	boost::thread_group workers_;
+	boost::mutex mutex_;
+	boost::condition_variable not_empty_;
+	boost::condition_variable not_full_;
+	std::deque<sensor_msgs::Image::ConstPtr> queue_;
+	size_t max_queue_;
+	bool done_;
+
+	vector<FrameResult> results_;
+	int frames_;
+	int objects_;
+};
+
+bool parseOptions(int argc, char **argv, ExportOptions &options) {
+	po::options_description desc("Allowed options");
+
+	desc.add_options()
+			("help,h", "produce help message")
+			("topic,t", po::value<string>()->default_value("/camera/image_color"), "camera topic of the dataset")
+			("output,o", po::value<string>(), "output directory (export/DATASET in the package by default)")
+			("threads,j", po::value<int>()->default_value(boost::thread::hardware_concurrency()),
+			 "number of threads converting and writing the frames")
+			("no-frames", "do not write the frames, only the labels and the crops")
+			("no-crops", "do not write the object crops")
+			("bag", po::value<string>(), "bag file the dataset was labelled from")
+			("dataset", po::value<string>(), "dataset file, relative to datasets/ in the package");
+
+	po::positional_options_description p;
+	p.add("bag", 1);
+	p.add("dataset", 1);
+
+	po::variables_map vm;
+	try {
+		po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+	} catch (po::error &e) {
+		ROS_ERROR("Error reading options: %s", e.what());
+		return false;
+	}
+
+	if (vm.count("help") || !vm.count("bag") || !vm.count("dataset")) {
+		cout << "usage: rosrun augmented_perception dataset_export <bag> <dataset> [options]\n" << desc << endl;
+		return false;
+	}
+
+	string package = ros::package::getPath("augmented_perception");
+	options.bag = vm["bag"].as<string>();
+	options.dataset = vm["dataset"].as<string>();
+	options.topic = vm["topic"].as<string>();
+	options.threads = std::max(vm["threads"].as<int>(), 1);
+	options.frames = !vm.count("no-frames");
+	options.crops = !vm.count("no-crops");
+
+	if (vm.count("output")) {
+		options.output = vm["output"].as<string>();
+	} else {
+		string name = options.dataset.substr(options.dataset.rfind('/') + 1);
+		name = name.substr(0, name.rfind('.'));
+		makeDirectory(package + "/export");
+		options.output = package + "/export/" + name;
+	}
+	if (options.dataset.find('/') == string::npos)
+		options.dataset = package + "/datasets/" + options.dataset;
+	return true;
+}
+
+int main(int argc, char **argv) {
+	ros::Time::init();
+
+	ExportOptions options;
+	if (!parseOptions(argc, argv, options))
+		return 1;
+
+	Dataset dataset;
+	if (!dataset.load(options.dataset)) {
+		ROS_ERROR("Could not read the dataset %s", options.dataset.c_str());
+		return 1;
+	}
+	ROS_INFO("Exporting %zu boxes of %s to %s with %d threads", dataset.boxes().size(), options.dataset.c_str(),
+			 options.output.c_str(), options.threads);
+
+	rosbag::Bag bag;
+	try {
+		bag.open(options.bag, rosbag::bagmode::Read);
+	}
+	catch (rosbag::BagException &e) {
+		ROS_ERROR("Could not open %s: %s", options.bag.c_str(), e.what());
+		return 1;
+	}
+
+	ros::WallTime start = ros::WallTime::now();
+	DatasetExporter exporter(options, dataset);
+
+	rosbag::View view(bag, rosbag::TopicQuery(options.topic));
+	int labelled = 0;
+	foreach(rosbag::MessageInstance m, view) {
+		sensor_msgs::Image::ConstPtr msg = m.instantiate<sensor_msgs::Image>();
+		if (!msg || dataset.count(msg->header.seq) == 0)
+			continue;
+
+		exporter.push(msg);
+		if (++labelled % 100 == 0)
+			ROS_INFO("Frame %u, %d labelled frames read", msg->header.seq, labelled);
+	}
+	exporter.finish();
+	bag.close();
+
+	string coco_path = options.output + "/annotations.json";
+	if (!exporter.writeCoco(coco_path))
+		ROS_ERROR("Could not write %s", coco_path.c_str());
+
+	ROS_INFO("Exported %d frames and %d objects in %.1f s", exporter.frames(), exporter.objects(),
+			 (ros::WallTime::now() - start).toSec());
+	return 0;
+}
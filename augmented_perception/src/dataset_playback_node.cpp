@@ -18,6 +18,9 @@
 #include <cstdlib>
 #include <iostream>
 
+#include "augmented_perception/dataset.h"
+#include "augmented_perception/overlay_renderer.h"
+
 using namespace std;
 using namespace cv;
 
@@ -26,17 +29,10 @@ image_transport::Publisher pub;
 cv_bridge::CvImagePtr cv_ptr;
 Mat image;
 
-struct BBox {
-	int x;
-	int y;
-	int width;
-	int height;
-	int id;
-	string label;
-};
-
 string filename;
-std::map<unsigned int, std::vector<BBox> > file_map;
+Dataset dataset;
+OverlayRenderer overlay;
+std::vector<int> label_styles;  // style of every label of the dataset, -1 for the ones not drawn
 bool foundframe = false;
 
 #define A 54059   /* a prime */
@@ -96,41 +92,31 @@ void HSVtoRGB(float &fR, float &fG, float &fB, float &fH, float &fS, float &fV)
 
 void initializeFileMap() {
 	string path = ros::package::getPath("augmented_perception") + "/datasets/" + filename;
-	std::ifstream infile(path.c_str());
-
-	string line;
-	unsigned int frame_id;
-
-	while (std::getline(infile, line)) {
-		if (line.find(" ") != std::string::npos)  // BBox
-		{
-			BBox box;
-			int x, y, width, height, id;
-			string label;
-
-			sscanf(line.substr(0, line.find(" ")).c_str(), "%d", &x);
-			line = line.substr(line.find(" ") + 1, line.length());
-			sscanf(line.substr(0, line.find(" ")).c_str(), "%d", &y);
-			line = line.substr(line.find(" ") + 1, line.length());
-			sscanf(line.substr(0, line.find(" ")).c_str(), "%d", &width);
-			line = line.substr(line.find(" ") + 1, line.length());
-			sscanf(line.substr(0, line.find(" ")).c_str(), "%d", &height);
-			line = line.substr(line.find(" ") + 1, line.length());
-			label = line.substr(0, line.find(" "));
-			line = line.substr(line.find(" ") + 1, line.length());
-			sscanf(line.substr(0, line.find(" ")).c_str(), "%d", &id);
-
-			box.x = x;
-			box.y = y;
-			box.width = width;
-			box.height = height;
-			box.id = id;
-			box.label = label;
-
-			file_map[frame_id].push_back(box);
-		} else {  // Frame
-			sscanf(line.c_str(), "%d", &frame_id);
+
+	ros::WallTime start = ros::WallTime::now();
+	if (!dataset.load(path)) {
+		ROS_ERROR("Could not read the dataset %s", path.c_str());
+		return;
+	}
+	ROS_INFO("Loaded %zu boxes of frames %u to %u in %.3f s", dataset.boxes().size(), dataset.firstFrame(),
+			 dataset.endFrame(), (ros::WallTime::now() - start).toSec());
+
+	// The colour of a label only depends on its name
+	label_styles.clear();
+	for (size_t l = 0; l < dataset.labels().size(); l++) {
+		const string &label = dataset.label(l);
+		if (label == "DontCare") {
+			label_styles.push_back(-1);
+			continue;
 		}
+
+		float hue = (hash_str(label.c_str()) % 255) * 1.0;
+
+		float r = 0, g = 0, b = 0, max = 255.0;
+
+		HSVtoRGB(r, g, b, hue, max, max);
+
+		label_styles.push_back(overlay.addStyle(label, Scalar(b, g, r)));
 	}
 }
 
@@ -147,13 +133,15 @@ void imageCallback(const sensor_msgs::ImageConstPtr &msg) {
 
 	// Your cv::Mat
 
-	std::vector<BBox> boxes;
+	const DatasetBox *boxes_begin = NULL, *boxes_end = NULL;
 
 	unsigned int actual_frame_id = cv_ptr->header.seq;
 
-	for (int i = 0; i < 5; i++) {
-		if (file_map[actual_frame_id - i].size() > 0) {
-			boxes = file_map[actual_frame_id];
+	// Boxes of this frame or of the closest of the 4 frames before it
+	for (unsigned int i = 0; i < 5 && i <= actual_frame_id; i++) {
+		if (dataset.count(actual_frame_id - i) > 0) {
+			boxes_begin = dataset.begin(actual_frame_id - i);
+			boxes_end = dataset.end(actual_frame_id - i);
 			foundframe = true;
 			break;
 		}
@@ -161,25 +149,10 @@ void imageCallback(const sensor_msgs::ImageConstPtr &msg) {
 	}
 
 	if (foundframe) {
-		for (int i = 0; i < boxes.size(); i++) {
-			BBox box = boxes[i];
-			if (box.label != "DontCare") {
-				float hue = (hash_str(box.label.c_str()) % 255) * 1.0;
-
-				float r = 0, g = 0, b = 0, max = 255.0;
-
-				HSVtoRGB(r, g, b, hue, max, max);
-
-				cv::rectangle(image, Point(box.x, box.y), Point(box.x + box.width, box.y + box.height), Scalar(b, g, r),
-							  3);
-				cv::rectangle(image, Point(box.x, box.y), Point(box.x + box.label.length() * 12 + 60, box.y - 15),
-							  Scalar(b, g, r), CV_FILLED);
-				string text = box.label + " ID:" + boost::lexical_cast<std::string>(box.id);
-				putText(image, text, cvPoint(box.x + 1, box.y - 1), FONT_HERSHEY_COMPLEX_SMALL, 0.8,
-						cvScalar(255, 255, 255), 1,
-						CV_AA);
-			}
-
+		for (const DatasetBox *it = boxes_begin; it != boxes_end; it++) {
+			const DatasetBox &box = *it;
+			if (label_styles[box.label] >= 0)
+				overlay.drawBox(image, Rect(box.x, box.y, box.width, box.height), label_styles[box.label], box.id);
 		}
 	}
 
@@ -0,0 +1,99 @@
+// Compares the per pixel getH/getV loop used by the ball detectors with the
+// table driven HueSegmenter on random frames of common camera resolutions.
+//
+// usage: rosrun augmented_perception hsv_segmentation_benchmark [iterations]
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <opencv2/core/core.hpp>
+
+#include "ball_segmentation/hsv_segmentation.h"
+
+using namespace cv;
+
+// The loop from ball_detection_node before HueSegmenter, lower half only
+void legacySegment(const Mat& bgr, Mat& mask, uchar hue, uchar Hthreshold)
+{
+	uchar hmax = hue + Hthreshold;
+	uchar hmin = hue - Hthreshold;
+
+	bool more_is_less = false;
+	if (hmax < hmin)
+	{
+		more_is_less = true;
+	}
+
+	mask = Mat::zeros(bgr.rows, bgr.cols, CV_8UC1);
+
+	for (int y = bgr.rows / 2; y < bgr.rows; y++)
+	{
+		for (int x = 0; x < bgr.cols; x++)
+		{
+			unsigned char b = bgr.at<Vec3b>(Point(x, y))[0];
+			unsigned char g = bgr.at<Vec3b>(Point(x, y))[1];
+			unsigned char r = bgr.at<Vec3b>(Point(x, y))[2];
+
+			int h = getH(r, g, b);
+			int v = getV(r, g, b);
+
+			if (v < 10)
+				continue;
+
+			if (((h > (int)hmax && h < (int)hmin) && more_is_less) || ((h > (int)hmax || h < (int)hmin) && !more_is_less))
+				continue;
+
+			mask.at<uchar>(y, x) = 255;
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : 20;
+	if (iterations < 1)
+		iterations = 1;
+
+	const Size resolutions[] = { Size(640, 480), Size(1280, 720), Size(1288, 964), Size(1920, 1080),
+	                             Size(2448, 2048), Size(3840, 2160) };
+	const uchar hues[] = { 2, 30, 128, 250 };
+
+	printf("%-11s %12s %12s %8s %10s\n", "resolution", "legacy [ms]", "table [ms]", "speedup", "mismatch");
+
+	for (size_t i = 0; i < sizeof(resolutions) / sizeof(resolutions[0]); i++)
+	{
+		Mat frame(resolutions[i], CV_8UC3);
+		randu(frame, Scalar::all(0), Scalar::all(256));
+
+		double legacy_time = 0, table_time = 0;
+		long mismatches = 0;
+
+		for (size_t h = 0; h < sizeof(hues) / sizeof(hues[0]); h++)
+		{
+			HueSegmenter segmenter(hues[h], 8, 10);
+			Mat legacy_mask, table_mask;
+
+			int64 t0 = getTickCount();
+			for (int it = 0; it < iterations; it++)
+				legacySegment(frame, legacy_mask, hues[h], 8);
+			int64 t1 = getTickCount();
+			for (int it = 0; it < iterations; it++)
+				segmenter.segment(frame, table_mask, frame.rows / 2);
+			int64 t2 = getTickCount();
+
+			legacy_time += (t1 - t0) * 1000.0 / getTickFrequency() / iterations;
+			table_time += (t2 - t1) * 1000.0 / getTickFrequency() / iterations;
+			mismatches += countNonZero(legacy_mask != table_mask);
+		}
+
+		legacy_time /= sizeof(hues) / sizeof(hues[0]);
+		table_time /= sizeof(hues) / sizeof(hues[0]);
+
+		char name[32];
+		sprintf(name, "%dx%d", frame.cols, frame.rows);
+		printf("%-11s %12.2f %12.2f %7.1fx %10ld\n", name, legacy_time, table_time, legacy_time / table_time,
+		       mismatches);
+	}
+
+	return 0;
+}
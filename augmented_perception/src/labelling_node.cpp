@@ -12,6 +12,10 @@
 #include "mtt/TargetList.h"
 #include "mtt/mtt.h"
 
+#include "augmented_perception/TargetListPacked.h"
+#include "augmented_perception/overlay_renderer.h"
+#include "std_msgs/Header.h"
+
 #include "pcl_ros/transforms.h"
 
 #include <cv_bridge/cv_bridge.h>
@@ -36,6 +40,8 @@ using namespace cv;
 ros::Publisher pub_targets;
 ros::Publisher markers_publisher;
 ros::Publisher pub_targetsSug;
+ros::Publisher pub_targets_packed;
+ros::Publisher pub_targetsSug_packed;
 ros::Publisher markers_publisherSug;
 
 ros::Publisher pub_scans;
@@ -43,6 +49,7 @@ ros::Publisher pub_scans_filtered;
 ros::Publisher pub_scans_suggest;
 
 ros::Publisher camera_lines_pub;
+ros::Publisher frame_ack_pub; // tells rosbag_player_node --lockstep that a frame is done
 
 image_transport::Publisher pc_image_proj;
 image_transport::Publisher box3d_image_proj;
@@ -86,6 +93,7 @@ tf::StampedTransform transformD, transformE;
 bool init_transforms = true;
 
 mtt::TargetListPC targetList;
+augmented_perception::TargetListPacked targetListPacked;
 
 t_config config;
 t_data full_data;
@@ -102,6 +110,7 @@ unsigned int tracking_bbox_id;
 // Suggestion MTT related variables
 
 mtt::TargetListPC targetListSug;
+augmented_perception::TargetListPacked targetListPackedSug;
 
 t_config configSug;
 t_data full_dataSug;
@@ -279,9 +288,7 @@ void MatchingMethod(int, void *) {
 
 	nframes++;
 
-	rectangle(imToShow, matchLoc,
-			  Point(matchLoc.x + patch.cols, matchLoc.y + patch.rows),
-			  Scalar(0, 0, 255), 2, 8, 0);
+	OverlayRenderer::drawFrame(imToShow, Rect(matchLoc.x, matchLoc.y, patch.cols, patch.rows), Scalar(0, 0, 255), 2);
 
 	/*rectangle(result, matchLoc, Point(matchLoc.x + (50 - box_x) * 6,
 	matchLoc.y + (50 - box_x) * 6), Scalar::all(0), 2, 8, 0);*/
@@ -468,6 +475,50 @@ void initClouds() {
 	pointDatapclSug += pointDataDpcl;
 }
 
+// Fill the flat target message. The message is kept between frames so the
+// arrays only reallocate when the number of targets/vertices grows.
+void packTargetList(vector<t_listPtr> &list, const std_msgs::Header &header,
+                    augmented_perception::TargetListPacked &packed) {
+	packed.header = header;
+
+	uint n_vertices = 0;
+	for (uint i = 0; i < list.size(); i++)
+		if (list[i]->shape.lines.size() > 0)
+			n_vertices += list[i]->shape.lines.size() + 1;
+
+	packed.id.resize(list.size());
+	packed.position.resize(2 * list.size());
+	packed.velocity.resize(2 * list.size());
+	packed.shape_offset.resize(list.size() + 1);
+	packed.shape_points.resize(2 * n_vertices);
+
+	uint v = 0;
+	for (uint i = 0; i < list.size(); i++) {
+		packed.id[i] = list[i]->id;
+
+		packed.position[2 * i] = list[i]->position.estimated_x;
+		packed.position[2 * i + 1] = list[i]->position.estimated_y;
+
+		packed.velocity[2 * i] = list[i]->velocity.velocity_x;
+		packed.velocity[2 * i + 1] = list[i]->velocity.velocity_y;
+
+		packed.shape_offset[i] = v;
+
+		uint n_lines = list[i]->shape.lines.size();
+		for (uint j = 0; j < n_lines; j++, v++) {
+			packed.shape_points[2 * v] = list[i]->shape.lines[j]->xi;
+			packed.shape_points[2 * v + 1] = list[i]->shape.lines[j]->yi;
+		}
+
+		if (n_lines > 0) {
+			packed.shape_points[2 * v] = list[i]->shape.lines[n_lines - 1]->xf;
+			packed.shape_points[2 * v + 1] = list[i]->shape.lines[n_lines - 1]->yf;
+			v++;
+		}
+	}
+	packed.shape_offset[list.size()] = v;
+}
+
 void initMTTSuggest() {
 
 	filter_suggest();
@@ -558,6 +609,9 @@ void initMTTSuggest() {
 
 	pub_targetsSug.publish(targetListSug);
 
+	packTargetList(list_vectorSug, targetListSug.header, targetListPackedSug);
+	pub_targetsSug_packed.publish(targetListPackedSug);
+
 	CreateMarkersSug(markersMsgSug.markers, targetListSug, list_vectorSug);
 
 	markers_publisherSug.publish(markersMsgSug);
@@ -657,6 +711,9 @@ void initMTT() {
 
 	pub_targets.publish(targetList);
 
+	packTargetList(list_vector, targetList.header, targetListPacked);
+	pub_targets_packed.publish(targetListPacked);
+
 	CreateMarkers(markersMsg.markers, targetList, list_vector);
 
 	markers_publisher.publish(markersMsg);
@@ -1010,8 +1067,8 @@ void image_cb_TemplateMatching(const sensor_msgs::ImageConstPtr &msg) {
 				min_y = pointbox.y;
 			}
 
-			cv::rectangle(imToShow, Point((int) min_x, (int) min_y),
-						  Point((int) max_x, (int) max_y), Scalar(0, 255, 0), 3);
+			OverlayRenderer::drawFrame(imToShow, Rect(Point((int) min_x, (int) min_y), Point((int) max_x, (int) max_y)),
+									   Scalar(0, 255, 0), 3);
 		}
 
 		cv::imshow("camera", imToShow);
@@ -1056,8 +1113,8 @@ void image_cb_TemplateMatching(const sensor_msgs::ImageConstPtr &msg) {
 
 		if (foundSug) {
 			float size = 500 - 12.5 * distanceSug;
-			rectangle(imToShow, Point(xSug - size / 2, 693 - size / 2),
-					  Point(xSug + size / 2, 693 + size / 2), Scalar(255, 0, 0), 3);
+			OverlayRenderer::drawFrame(imToShow, Rect(Point(xSug - size / 2, 693 - size / 2),
+													  Point(xSug + size / 2, 693 + size / 2)), Scalar(255, 0, 0), 3);
 			imshow("camera", imToShow);
 		}
 	}
@@ -1069,8 +1126,8 @@ void image_cb_TemplateMatching(const sensor_msgs::ImageConstPtr &msg) {
 			int xSug = -(angleSug / 0.01745329252 * 27.0) + 812;
 
 			float size = 500 - 12.5 * (sqrt(pow(vectorMTTposSug.at(i*2), 2) + pow(vectorMTTposSug.at(i*2+1), 2)));
-			rectangle(allMTT, Point(xSug - size / 2, 693 - size / 2), Point(xSug + size / 2, 693 + size / 2),
-					  Scalar(0, 255, 0), 3);
+			OverlayRenderer::drawFrame(allMTT, Rect(Point(xSug - size / 2, 693 - size / 2),
+													Point(xSug + size / 2, 693 + size / 2)), Scalar(0, 255, 0), 3);
 		}
 	}
 
@@ -1232,6 +1289,7 @@ void image_cb_TemplateMatching(const sensor_msgs::ImageConstPtr &msg) {
 
 	pc_image_proj.publish(out_msg.toImageMsg());
 
+	frame_ack_pub.publish(msg->header);
 }
 
 void laserToPC2(const sensor_msgs::LaserScan::ConstPtr &input) {
@@ -1314,7 +1372,10 @@ int main(int argc, char **argv) {
 	markers_publisher = nh.advertise<visualization_msgs::MarkerArray>("/markers", 1000);
 	pub_targetsSug = nh.advertise<mtt::TargetListPC>("/targetsSug", 1000);
 	markers_publisherSug = nh.advertise<visualization_msgs::MarkerArray>("/markersSug", 1000);
+	pub_targets_packed = nh.advertise<augmented_perception::TargetListPacked>("/targets_packed", 1000);
+	pub_targetsSug_packed = nh.advertise<augmented_perception::TargetListPacked>("/targetsSug_packed", 1000);
 	camera_lines_pub = nh.advertise<visualization_msgs::Marker>("/camera_range_lines", 0);
+	frame_ack_pub = nh.advertise<std_msgs::Header>("/frame_ack", 10);
 
 	pc_image_proj = it.advertise("image/pc_projection", 1);
 	box3d_image_proj = it.advertise("image/box3d_projection", 1);
@@ -6,7 +6,16 @@
 #include <sys/select.h>
 #include <boost/foreach.hpp>
 #include <boost/format.hpp>
+#include <boost/thread.hpp>
+#include <deque>
+#include <queue>
+#include <algorithm>
+#include <boost/function.hpp>
+#include "ros/serialization.h"
 #include "rosgraph_msgs/Clock.h"
+#include "std_msgs/Header.h"
+#include "topic_tools/shape_shifter.h"
+#include "augmented_perception/Seek.h"
 
 #include "boost/program_options.hpp"
 
@@ -21,6 +30,637 @@ using ros::Exception;
 
 namespace po = boost::program_options;
 
+namespace {
+
+	/**
+	 * Message read and decompressed ahead of playback, kept as its serialized bytes
+	 */
+	struct DecodedMessage {
+		shared_ptr<rosbag::MessageInstance> instance;
+		topic_tools::ShapeShifter::ConstPtr message;
+		ros::Time stamp; // header stamp of a frame of the camera topic, zero for other messages
+	};
+
+	// True if the first field of the message definition is a Header
+	bool startsWithHeader(string const &definition) {
+		size_t line = 0;
+		while (line < definition.size()) {
+			size_t end = definition.find('\n', line);
+			if (end == string::npos)
+				end = definition.size();
+			size_t first = definition.find_first_not_of(" \t\r", line);
+			if (first < end && definition[first] != '#')
+				return definition.compare(first, 7, "Header ") == 0 ||
+					   definition.compare(first, 16, "std_msgs/Header ") == 0;
+			line = end + 1;
+		}
+		return false;
+	}
+
+	/**
+	 * Stamp of the header of a message that starts with one, zero for other messages. The
+	 * ShapeShifter does not expose its bytes, so the message is copied into the buffer to read them.
+	 */
+	ros::Time headerStamp(topic_tools::ShapeShifter const &message, vector<uint8_t> &buffer) {
+		uint32_t size = message.size();
+		if (size < 12 || !startsWithHeader(message.getMessageDefinition()))
+			return ros::Time();
+
+		buffer.resize(size);
+		ros::serialization::OStream out(&buffer[0], size);
+		message.write(out);
+
+		uint32_t seq;
+		ros::Time stamp;
+		ros::serialization::IStream in(&buffer[0], size);
+		in.next(seq);
+		in.next(stamp);
+		return stamp;
+	}
+
+	/**
+	 * Reads the messages of a view on its own thread into a queue bounded in bytes, so the chunk
+	 * reads, the decompression and the instantiation never happen on the thread that keeps the
+	 * playback time. That thread only waits on the clock and publishes the ready buffers.
+	 */
+	class ReadAhead {
+	public:
+		ReadAhead() : max_bytes_(0), bytes_(0), done_(true), stop_(false) {}
+
+		~ReadAhead() { stop(); }
+
+		// The header stamp of the messages of the frame topic is read along with them
+		void start(rosbag::View &view, size_t max_bytes, string const &frame_topic) {
+			stop();
+			max_bytes_ = max_bytes;
+			frame_topic_ = frame_topic;
+			done_ = false;
+			stop_ = false;
+			thread_ = boost::thread(boost::bind(&ReadAhead::read, this, boost::ref(view)));
+		}
+
+		// Blocks until the next message is decoded, false once the view is exhausted
+		bool pop(DecodedMessage &decoded) {
+			boost::unique_lock<boost::mutex> lock(mutex_);
+			while (queue_.empty() && !done_)
+				not_empty_.wait(lock);
+			if (queue_.empty())
+				return false;
+
+			decoded = queue_.front();
+			queue_.pop_front();
+			bytes_ -= decoded.message->size();
+			not_full_.notify_one();
+			return true;
+		}
+
+		void stop() {
+			{
+				boost::lock_guard<boost::mutex> lock(mutex_);
+				stop_ = true;
+			}
+			not_full_.notify_all();
+			if (thread_.joinable())
+				thread_.join();
+
+			queue_.clear();
+			bytes_ = 0;
+			done_ = true;
+		}
+
+	private:
+		void read(rosbag::View &view) {
+			try {
+				foreach(rosbag::MessageInstance m, view) {
+					DecodedMessage decoded;
+					decoded.instance.reset(new rosbag::MessageInstance(m));
+					decoded.message = m.instantiate<topic_tools::ShapeShifter>();
+					if (m.getTopic() == frame_topic_)
+						decoded.stamp = headerStamp(*decoded.message, buffer_);
+					size_t size = decoded.message->size();
+
+					boost::unique_lock<boost::mutex> lock(mutex_);
+					// A message bigger than the whole budget still goes through, alone
+					while (!stop_ && !queue_.empty() && bytes_ + size > max_bytes_)
+						not_full_.wait(lock);
+					if (stop_)
+						return;
+
+					queue_.push_back(decoded);
+					bytes_ += size;
+					not_empty_.notify_one();
+				}
+			}
+			catch (rosbag::BagException &e) {
+				ROS_ERROR("Error reading the bag: %s", e.what());
+			}
+
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			done_ = true;
+			not_empty_.notify_all();
+		}
+
+		boost::thread thread_;
+		boost::mutex mutex_;
+		boost::condition_variable not_empty_;
+		boost::condition_variable not_full_;
+		std::deque<DecodedMessage> queue_;
+		string frame_topic_;
+		vector<uint8_t> buffer_; // serialized frame, only its header is read
+		size_t max_bytes_;
+		size_t bytes_;
+		bool done_;
+		bool stop_;
+	};
+
+	/**
+	 * Time of every frame of the camera topic, taken from the bag indexes without reading any
+	 * message. Seeking and stepping back move between these frames. Only the camera topic is
+	 * indexed, so opening a bag costs its number of frames, not of messages.
+	 * Bags are added as they are opened, from the threads that open them.
+	 */
+	class TimeIndex {
+	public:
+		// Set before the bags are indexed
+		void setFrameTopic(string const &frame_topic) { frame_topic_ = frame_topic; }
+
+		void add(rosbag::Bag &bag) {
+			if (frame_topic_.empty())
+				return;
+
+			rosbag::View view(bag, rosbag::TopicQuery(frame_topic_));
+			vector<ros::Time> times;
+			times.reserve(view.size());
+			foreach(rosbag::MessageInstance m, view) times.push_back(m.getTime());
+
+			// Views are sorted by time, bags opened out of order are merged in place
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			size_t middle = frames_.size();
+			frames_.insert(frames_.end(), times.begin(), times.end());
+			std::inplace_merge(frames_.begin(), frames_.begin() + middle, frames_.end());
+		}
+
+		string const &frameTopic() const { return frame_topic_; }
+
+		int frames() {
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			return frames_.size();
+		}
+
+		ros::Time frameTime(int frame) {
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			return frames_[frame];
+		}
+
+		// Last frame at or before the time, -1 if there is none
+		int frameAt(ros::Time const &time) {
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			return std::upper_bound(frames_.begin(), frames_.end(), time) - frames_.begin() - 1;
+		}
+
+	private:
+		boost::mutex mutex_;
+		vector<ros::Time> frames_;
+		string frame_topic_;
+	};
+
+	void addQuery(rosbag::View &view, rosbag::Bag &bag, vector<string> const &topics, ros::Time const &start) {
+		if (topics.empty())
+			view.addQuery(bag, start, ros::TIME_MAX);
+		else
+			view.addQuery(bag, rosbag::TopicQuery(topics), start, ros::TIME_MAX);
+	}
+
+	/**
+	 * One bag of the playback. It is opened on a thread of its own the first time it is started,
+	 * then read ahead by its own ReadAhead. Its begin and end times stay known once it is closed.
+	 */
+	class BagCursor {
+	public:
+		BagCursor(string const &filename) : filename_(filename), ready_(false), known_(false), indexed_(false) {}
+
+		~BagCursor() { close(); }
+
+		// Starts reading at the time, the bag is opened on another thread if it is not open yet
+		void start(vector<string> const &topics, ros::Time const &from, size_t bytes, TimeIndex *index) {
+			stop();
+			frame_topic_ = index ? index->frameTopic() : string();
+			if (bag_) {
+				read(topics, from, bytes);
+				return;
+			}
+			{
+				boost::lock_guard<boost::mutex> lock(mutex_);
+				ready_ = false;
+			}
+			opener_ = boost::thread(boost::bind(&BagCursor::openAndRead, this, topics, from, bytes, index));
+		}
+
+		// Opens the bag on the calling thread, false if it could not be opened. The frames are
+		// added to the index unless it is NULL.
+		bool load(TimeIndex *index) {
+			stop();
+			if (bag_)
+				return true;
+
+			try {
+				shared_ptr<rosbag::Bag> bag(new rosbag::Bag);
+				bag->open(filename_, rosbag::bagmode::Read);
+				rosbag::View all(*bag);
+				begin_ = all.getBeginTime();
+				end_ = all.getEndTime();
+				known_ = true;
+				bag_ = bag;
+				addFrames(index);
+			}
+			catch (rosbag::BagUnindexedException &e) {
+				ROS_ERROR("Bag file %s is unindexed.  Run rosbag reindex.", filename_.c_str());
+			}
+			catch (rosbag::BagException &e) {
+				ROS_ERROR("Could not open %s: %s", filename_.c_str(), e.what());
+			}
+
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			ready_ = true;
+			return bag_.get() != NULL;
+		}
+
+		// True once the bag is open, or failed to open. Never blocks.
+		bool ready() {
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			return ready_;
+		}
+
+		// Blocks until the bag opened by start() is open, false if it could not be opened
+		bool wait() {
+			if (opener_.joinable())
+				opener_.join();
+			return bag_.get() != NULL;
+		}
+
+		bool next(DecodedMessage &decoded) { return read_ahead_.pop(decoded); }
+
+		void stop() {
+			wait();
+			read_ahead_.stop();
+		}
+
+		void close() {
+			stop();
+			view_.reset();
+			if (bag_)
+				bag_->close();
+			bag_.reset();
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			ready_ = false;
+		}
+
+		// Adds the frames of the open bag to the index, once
+		void addFrames(TimeIndex *index) {
+			if (index && bag_ && !indexed_) {
+				index->add(*bag_);
+				indexed_ = true;
+			}
+		}
+
+		bool known() const { return known_; }
+
+		ros::Time const &begin() const { return begin_; }
+
+		ros::Time const &end() const { return end_; }
+
+		rosbag::Bag &bag() { return *bag_; }
+
+		rosbag::View &view() { return *view_; }
+
+	private:
+		void openAndRead(vector<string> topics, ros::Time from, size_t bytes, TimeIndex *index) {
+			if (load(index))
+				read(topics, from, bytes);
+		}
+
+		void read(vector<string> const &topics, ros::Time const &from, size_t bytes) {
+			view_.reset(new rosbag::View);
+			addQuery(*view_, *bag_, topics, from);
+			read_ahead_.start(*view_, bytes, frame_topic_);
+		}
+
+		string filename_;
+		string frame_topic_;
+		shared_ptr<rosbag::Bag> bag_;
+		shared_ptr<rosbag::View> view_;
+		ReadAhead read_ahead_;
+		boost::thread opener_;
+		boost::mutex mutex_;
+		bool ready_;
+		bool known_;
+		bool indexed_;
+		ros::Time begin_;
+		ros::Time end_;
+	};
+
+	/**
+	 * Plays several bags as one, merging their cursors with a min-heap on the time of their next
+	 * message. The bags are expected in chronological order, as rosbag record --split writes them:
+	 * a bag is only needed once playback reaches the beginning of the bag before it, so it is
+	 * opened (and read ahead) one bag earlier than that, and closed once exhausted. Startup does
+	 * not depend on the number of bags and memory is bounded by the read ahead of the open ones.
+	 */
+	class MergedReader {
+	public:
+		MergedReader() : bytes_(0), index_(NULL), first_(0), active_(0), exhausted_(-1) {}
+
+		~MergedReader() { close(); }
+
+		// opened is called on the playback thread with the view of every bag that opens
+		void open(vector<string> const &filenames, vector<string> const &topics, size_t bytes, TimeIndex *index,
+				  boost::function<void(rosbag::View &)> const &opened) {
+			close();
+			cursors_.clear();
+			foreach(string const &filename, filenames) cursors_.push_back(shared_ptr<BagCursor>(new BagCursor(filename)));
+			topics_ = topics;
+			bytes_ = bytes;
+			index_ = index;
+			opened_ = opened;
+			heads_.assign(cursors_.size(), DecodedMessage());
+			started_.assign(cursors_.size(), false);
+			announced_.assign(cursors_.size(), false);
+		}
+
+		BagCursor &cursor(int i) { return *cursors_[i]; }
+
+		// Latest end time of the bags opened so far
+		ros::Time const &end() const { return end_; }
+
+		// Reading restarts at the time, the bags known to end before it are skipped
+		void start(ros::Time const &from) {
+			stop();
+			from_ = from;
+			first_ = 0;
+			while (first_ + 1 < cursors_.size() && cursors_[first_]->known() && cursors_[first_]->end() < from)
+				first_++;
+			active_ = first_;
+		}
+
+		bool pop(DecodedMessage &decoded) {
+			// The last message of an exhausted bag has been published by now
+			if (exhausted_ >= 0) {
+				cursors_[exhausted_]->close();
+				heads_[exhausted_] = DecodedMessage();
+				exhausted_ = -1;
+			}
+			announce();
+
+			// The next bag may hold messages as early as the beginning of the bag before it
+			while (active_ < cursors_.size() && (heap_.empty() || cursors_[active_ - 1]->begin() <= heap_.top().first))
+				activate(active_);
+
+			if (heap_.empty())
+				return false;
+
+			int i = heap_.top().second;
+			heap_.pop();
+			decoded = heads_[i];
+			advance(i);
+			return true;
+		}
+
+		void stop() {
+			foreach(shared_ptr<BagCursor> cursor, cursors_) cursor->stop();
+			heap_ = Heap();
+			started_.assign(cursors_.size(), false);
+		}
+
+		void close() {
+			foreach(shared_ptr<BagCursor> cursor, cursors_) cursor->close();
+			heap_ = Heap();
+			heads_.assign(cursors_.size(), DecodedMessage());
+			exhausted_ = -1;
+		}
+
+	private:
+		typedef pair<ros::Time, int> Entry;
+		typedef std::priority_queue<Entry, vector<Entry>, std::greater<Entry> > Heap;
+
+		void startCursor(int i) {
+			cursors_[i]->start(topics_, from_, bytes_, index_);
+			started_[i] = true;
+		}
+
+		void activate(int i) {
+			active_ = i + 1;
+			if (!started_[i])
+				startCursor(i);
+			if (cursors_[i]->wait()) {
+				announce();
+				advance(i);
+			}
+
+			// Open the following bag while this one plays
+			if (i + 1 < cursors_.size() && !started_[i + 1])
+				startCursor(i + 1);
+		}
+
+		void advance(int i) {
+			if (cursors_[i]->next(heads_[i]))
+				heap_.push(Entry(heads_[i].instance->getTime(), i));
+			else
+				exhausted_ = i; // its index is not needed anymore, but the message still points into it
+		}
+
+		// Advertise the topics of the bags that finished opening
+		void announce() {
+			for (int i = first_; i < cursors_.size() && i <= active_; i++) {
+				if (announced_[i] || !started_[i] || !cursors_[i]->ready() || !cursors_[i]->known())
+					continue;
+				announced_[i] = true;
+				if (cursors_[i]->end() > end_)
+					end_ = cursors_[i]->end();
+				if (cursors_[i]->wait() && opened_)
+					opened_(cursors_[i]->view());
+			}
+		}
+
+		vector<shared_ptr<BagCursor> > cursors_;
+		vector<DecodedMessage> heads_;
+		vector<bool> started_;
+		vector<bool> announced_;
+		Heap heap_;
+		vector<string> topics_;
+		size_t bytes_;
+		TimeIndex *index_;
+		boost::function<void(rosbag::View &)> opened_;
+		ros::Time from_;
+		ros::Time end_;
+		int first_;  // first bag of the current reading
+		int active_; // bags [first_, active_) take part in the merge
+		int exhausted_;
+	};
+
+	/**
+	 * Jump asked by the keyboard or the seek service. Playback restarts reading at start, and
+	 * everything up to until (the frame sought) is published at once.
+	 */
+	class SeekRequest {
+	public:
+		SeekRequest() : pending_(false) {}
+
+		bool pending() {
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			return pending_;
+		}
+
+		void request(ros::Time const &start, ros::Time const &until) {
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			start_ = start;
+			until_ = until;
+			pending_ = true;
+		}
+
+		bool take(ros::Time &start, ros::Time &until) {
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			if (!pending_)
+				return false;
+			start = start_;
+			until = until_;
+			pending_ = false;
+			return true;
+		}
+
+	private:
+		boost::mutex mutex_;
+		bool pending_;
+		ros::Time start_;
+		ros::Time until_;
+	};
+
+	/**
+	 * Lock-step playback: after a frame of the camera topic nothing else is published until the
+	 * consumer acknowledges it, so playback runs exactly as fast as the frames are processed
+	 */
+	class LockStep {
+	public:
+		LockStep() : enabled(false), timeout(0), waiting_(false) {}
+
+		// Called before the frame is published, so its acknowledgement cannot arrive first. The
+		// consumer acknowledges with the header of the frame, so a late or repeated acknowledgement
+		// of an earlier frame does not release the next one. Frames without a header (zero stamp)
+		// are released by any acknowledgement.
+		void sending(ros::Time const &stamp) {
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			waiting_ = true;
+			sent_stamp_ = stamp;
+			sent_time_ = ros::WallTime::now();
+		}
+
+		void ack(const std_msgs::Header::ConstPtr &header) {
+			{
+				boost::lock_guard<boost::mutex> lock(mutex_);
+				if (!waiting_)
+					return;
+				if (!sent_stamp_.isZero() && header->stamp != sent_stamp_) {
+					ROS_DEBUG("Ignoring the acknowledgement of %.6f, waiting for %.6f", header->stamp.toSec(),
+							  sent_stamp_.toSec());
+					return;
+				}
+				waiting_ = false;
+			}
+			acked_.notify_all();
+		}
+
+		// Waits at most the given time, true once the last frame is acknowledged
+		bool wait(ros::WallDuration const &duration) {
+			boost::unique_lock<boost::mutex> lock(mutex_);
+			if (waiting_)
+				acked_.timed_wait(lock, boost::posix_time::microseconds(duration.toNSec() / 1000));
+			if (waiting_ && timeout > 0 && (ros::WallTime::now() - sent_time_).toSec() > timeout) {
+				ROS_WARN("No acknowledgement after %.1f s, releasing the next frame", timeout);
+				waiting_ = false;
+			}
+			return !waiting_;
+		}
+
+		bool enabled;
+		double timeout; // seconds, 0 waits forever
+
+	private:
+		boost::mutex mutex_;
+		boost::condition_variable acked_;
+		bool waiting_;
+		ros::Time sent_stamp_;
+		ros::WallTime sent_time_;
+	};
+
+	// PlayerOptions and Player come from the rosbag headers, the settings and state added by this
+	// node live here
+	size_t read_ahead_bytes = 256 * 1024 * 1024;
+	string frame_topic_option;
+	MergedReader reader;
+	topic_tools::ShapeShifter::ConstPtr current_message; // decoded bytes of the message in doPublish
+	ros::Time current_stamp;                             // header stamp of current_message if it is a frame
+	TimeIndex time_index;
+	SeekRequest seek;
+	ros::Time catch_up_until; // messages up to this time are published without waiting
+	ros::Time last_frame;     // time of the last frame published
+	LockStep lock_step;
+
+	void publishMessage(ros::Publisher &pub, rosbag::MessageInstance const &m) {
+		if (current_message)
+			pub.publish(*current_message);
+		else
+			pub.publish(m);
+
+		if (m.getTopic() == time_index.frameTopic())
+			last_frame = m.getTime();
+	}
+
+	/**
+	 * Ask to show a frame again: reading restarts right after the previous frame, so the scans
+	 * received between both frames are published too
+	 */
+	bool requestFrame(int frame) {
+		if (frame < 0 || frame >= time_index.frames())
+			return false;
+
+		ros::Time start = ros::TIME_MIN;
+		if (frame > 0)
+			start = time_index.frameTime(frame - 1) + ros::Duration(0, 1);
+		seek.request(start, time_index.frameTime(frame));
+		return true;
+	}
+
+	bool requestStepBack() {
+		if (last_frame.isZero())
+			return false;
+		return requestFrame(time_index.frameAt(last_frame) - 1);
+	}
+
+	bool seekService(augmented_perception::Seek::Request &req, augmented_perception::Seek::Response &res) {
+		int frame = req.stamp.isZero() ? req.frame : time_index.frameAt(req.stamp);
+		res.success = requestFrame(frame);
+		if (res.success) {
+			res.frame = frame;
+			res.stamp = time_index.frameTime(frame);
+		}
+		return true;
+	}
+
+	void advertiseConnections(ros::NodeHandle &node_handle, map<string, ros::Publisher> &publishers,
+							  uint32_t queue_size, rosbag::View &view) {
+		foreach(const rosbag::ConnectionInfo *c, view.getConnections()) {
+			ros::M_string::const_iterator header_iter = c->header->find("callerid");
+			string callerid = (header_iter != c->header->end() ? header_iter->second : string(""));
+
+			string callerid_topic = callerid + c->topic;
+			if (publishers.find(callerid_topic) == publishers.end()) {
+				ros::AdvertiseOptions opts = rosbag::createAdvertiseOptions(c, queue_size);
+				publishers.insert(pair<string, ros::Publisher>(callerid_topic, node_handle.advertise(opts)));
+			}
+		}
+	}
+
+}
+
 namespace rosbag {
 
 	// PlayerOptions
@@ -81,20 +721,10 @@ namespace rosbag {
 	void Player::publish() {
 		options_.check();
 
-		// Open all the bag files
-				foreach(string const &filename, options_.bags) {
-						ROS_INFO("Opening %s", filename.c_str());
-
-						try {
-							shared_ptr<Bag> bag(new Bag);
-							bag->open(filename, bagmode::Read);
-							bags_.push_back(bag);
-						}
-						catch (BagUnindexedException ex) {
-							std::cerr << "Bag file " << filename << " is unindexed.  Run rosbag reindex." << std::endl;
-							return;
-						}
-					}
+		// The bags are opened lazily, in the order given, as playback reaches them
+		reader.open(options_.bags, options_.topics, read_ahead_bytes, &time_index,
+					boost::bind(advertiseConnections, boost::ref(node_handle_), boost::ref(publishers_),
+								options_.queue_size, _1));
 
 		setupTerminal();
 
@@ -104,66 +734,73 @@ namespace rosbag {
 		if (!options_.quiet)
 			puts("");
 
-		// Publish all messages in the bags
-		View full_view;
-				foreach(shared_ptr<Bag> bag, bags_) full_view.addQuery(*bag);
-
-		ros::Time initial_time = full_view.getBeginTime();
+		// The first bag gives the start of playback and the camera topic, it is indexed once
+		// the camera topic is known
+		BagCursor &first_bag = reader.cursor(0);
+		if (!first_bag.load(NULL)) {
+			ros::shutdown();
+			return;
+		}
+		ros::Time initial_time = first_bag.begin();
 
 		initial_time += ros::Duration(options_.time);
 
-
-		View view;
-		TopicQuery topics(options_.topics);
-
-		if (options_.topics.empty()) {
-					foreach(shared_ptr<Bag> bag, bags_) view.addQuery(*bag, initial_time, ros::TIME_MAX);
-		} else {
-					foreach(shared_ptr<Bag> bag, bags_) view.addQuery(*bag, topics, initial_time, ros::TIME_MAX);
+		// Index of the frames of the camera topic, for seeking and stepping back
+		string frame_topic = frame_topic_option;
+		if (frame_topic.empty()) {
+			View first_view(first_bag.bag());
+			foreach(const ConnectionInfo *c, first_view.getConnections()) {
+				if (c->datatype == "sensor_msgs/Image" || c->datatype == "sensor_msgs/CompressedImage") {
+					frame_topic = c->topic;
+					break;
+				}
+			}
 		}
+		time_index.setFrameTopic(frame_topic);
+		first_bag.addFrames(&time_index);
 
-		if (view.size() == 0) {
+		// Opening the bags advertises their topics
+		reader.start(initial_time);
+		DecodedMessage decoded;
+		if (!reader.pop(decoded)) {
 			std::cerr << "No messages to play on specified topics.  Exiting." << std::endl;
 			ros::shutdown();
 			return;
 		}
 
-		// Advertise all of our messages
-				foreach(const ConnectionInfo *c, view.getConnections()) {
-						ros::M_string::const_iterator header_iter = c->header->find("callerid");
-						std::string callerid = (header_iter != c->header->end() ? header_iter->second : string(""));
-
-						string callerid_topic = callerid + c->topic;
-
-						map<string, ros::Publisher>::iterator pub_iter = publishers_.find(callerid_topic);
-						if (pub_iter == publishers_.end()) {
-
-							ros::AdvertiseOptions opts = createAdvertiseOptions(c, options_.queue_size);
-
-							ros::Publisher pub = node_handle_.advertise(opts);
-							publishers_.insert(publishers_.begin(), pair<string, ros::Publisher>(callerid_topic, pub));
-
-							pub_iter = publishers_.find(callerid_topic);
-						}
-					}
+		ROS_INFO("Indexed %d frames of %s", time_index.frames(), frame_topic.c_str());
+		ros::ServiceServer seek_service = node_handle_.advertiseService("seek", seekService);
+		ros::Subscriber ack_subscriber;
+		if (lock_step.enabled)
+			ack_subscriber = node_handle_.subscribe("frame_ack", 10, &LockStep::ack, &lock_step);
 
 		std::cout << "Waiting " << options_.advertise_sleep.toSec() << " seconds after advertising topics..."
 				  << std::flush;
 		options_.advertise_sleep.sleep();
 		std::cout << " done." << std::endl;
 
-		std::cout << std::endl << "Hit space to toggle paused, or 's' to step." << std::endl;
+		std::cout << std::endl << "Hit space to toggle paused, 's' to step, or 'a' to step back a frame." << std::endl;
 
 		paused_ = options_.start_paused;
 
+		bool have_message = true;
 		while (true) {
 			// Set up our time_translator and publishers
 
 			time_translator_.setTimeScale(options_.time_scale);
 
-			start_time_ = view.begin()->getTime();
+			// A seek may have moved the reader, every loop starts from the beginning again
+			catch_up_until = ros::Time();
+			if (!have_message) {
+				reader.start(initial_time);
+				if (!reader.pop(decoded))
+					break;
+			}
+			have_message = false;
+
+			start_time_ = decoded.instance->getTime();
 			time_translator_.setRealStartTime(start_time_);
-			bag_length_ = view.getEndTime() - view.getBeginTime();
+			bag_length_ = reader.end() - start_time_;
 
 			time_publisher_.setTime(start_time_);
 
@@ -179,13 +816,27 @@ namespace rosbag {
 
 			paused_time_ = now_wt;
 
-			// Call do-publish for each message
-					foreach(MessageInstance m, view) {
-							if (!node_handle_.ok())
-								break;
-
-							doPublish(m);
-						}
+			// Call do-publish for each message, decoded ahead by the read-ahead threads of the bags
+			do {
+				current_message = decoded.message;
+				current_stamp = decoded.stamp;
+				doPublish(*decoded.instance);
+
+				ros::Time seek_start;
+				if (seek.take(seek_start, catch_up_until)) {
+					// The bag indexes find the new start in O(log n), only the read ahead is lost
+					reader.start(seek_start);
+
+					time_translator_.setRealStartTime(catch_up_until);
+					now_wt = ros::WallTime::now();
+					time_translator_.setTranslatedStartTime(ros::Time(now_wt.sec, now_wt.nsec));
+					paused_time_ = now_wt;
+				}
+				bag_length_ = reader.end() - start_time_;
+			} while (node_handle_.ok() && reader.pop(decoded));
+			current_message.reset();
+			current_stamp = ros::Time();
+			reader.stop();
 
 			if (options_.keep_alive)
 				while (node_handle_.ok())
@@ -201,6 +852,7 @@ namespace rosbag {
 			}
 		}
 
+		reader.close();
 		ros::shutdown();
 	}
 
@@ -237,10 +889,41 @@ namespace rosbag {
 		map<string, ros::Publisher>::iterator pub_iter = publishers_.find(callerid_topic);
 		ROS_ASSERT(pub_iter != publishers_.end());
 
-		// If immediate specified, play immediately
-		if (options_.at_once) {
+		// In lock-step the consumer sets the pace, the keyboard can still pause or step back
+		if (lock_step.enabled) {
+			while (node_handle_.ok() && (paused_ || !lock_step.wait(ros::WallDuration(.1)))) {
+				if (seek.pending())
+					return;
+
+				switch (readCharFromStdin()) {
+					case ' ':
+						paused_ = !paused_;
+						if (paused_)
+							paused_time_ = ros::WallTime::now();
+						break;
+					case 'a':
+						if (paused_ && requestStepBack())
+							return;
+						break;
+					case EOF:
+						if (paused_)
+							time_publisher_.runStalledClock(ros::WallDuration(.1));
+				}
+				printTime();
+			}
+
 			time_publisher_.stepClock();
-			pub_iter->second.publish(m);
+			if (topic == time_index.frameTopic())
+				lock_step.sending(current_stamp);
+			publishMessage(pub_iter->second, m);
+			printTime();
+			return;
+		}
+
+		// If immediate specified, or catching up to a frame sought, play immediately
+		if (options_.at_once || time <= catch_up_until) {
+			time_publisher_.stepClock();
+			publishMessage(pub_iter->second, m);
 			printTime();
 			return;
 		}
@@ -253,7 +936,7 @@ namespace rosbag {
 			time_translator_.shift(ros::Duration(shift.sec, shift.nsec));
 			horizon += shift;
 			time_publisher_.setWCHorizon(horizon);
-			(pub_iter->second).publish(m);
+			publishMessage(pub_iter->second, m);
 			printTime();
 			return;
 		}
@@ -261,6 +944,10 @@ namespace rosbag {
 		while ((paused_ || !time_publisher_.horizonReached()) && node_handle_.ok()) {
 			bool charsleftorpaused = true;
 			while (charsleftorpaused && node_handle_.ok()) {
+				// A seek drops the message, playback goes on from the new position
+				if (seek.pending())
+					return;
+
 				switch (readCharFromStdin()) {
 					case ' ':
 						paused_ = !paused_;
@@ -288,30 +975,15 @@ namespace rosbag {
 							horizon += shift;
 							time_publisher_.setWCHorizon(horizon);
 
-							(pub_iter->second).publish(m);
+							publishMessage(pub_iter->second, m);
 
 							printTime();
 							return;
 						}
 						break;
 					case 'a':
-						if (paused_) {
-							time_publisher_.stepBackClock();
-
-							ros::WallDuration shift = ros::WallTime::now() - horizon;
-							paused_time_ = ros::WallTime::now();
-
-							time_translator_.shift(ros::Duration(shift.sec, shift.nsec));
-
-							horizon -= shift;
-
-							time_publisher_.setWCHorizon(horizon);
-
-							(pub_iter->second).publish(m);
-
-							printTime();
+						if (paused_ && requestStepBack())
 							return;
-						}
 						break;
 					case EOF:
 						if (paused_) {
@@ -326,7 +998,7 @@ namespace rosbag {
 			time_publisher_.runClock(ros::WallDuration(.1));
 		}
 
-		pub_iter->second.publish(m);
+		publishMessage(pub_iter->second, m);
 	}
 
 
@@ -601,6 +1273,13 @@ rosbag::PlayerOptions parseOptions(int argc, char **argv) {
 			("keep-alive,k", "keep alive past end of bag")
 			("try-future-version",
 			 "still try to open a bag file, even if the version is not known to the player")
+			("frame-topic", po::value<std::string>(),
+			 "camera topic whose frames are used to seek and step back (first image topic by default)")
+			("lockstep", "publish the next frame only after the previous one is acknowledged on frame_ack")
+			("lockstep-timeout", po::value<float>()->default_value(0.0),
+			 "release the next frame anyway after SEC seconds without acknowledgement, 0 waits forever")
+			("read-ahead", po::value<float>()->default_value(256.0),
+			 "decode up to MB megabytes of messages ahead of playback, for every open bag")
 			("skip-empty", po::value<float>(),
 			 "skip regions in the bag with no messages for more than SEC seconds")
 			("topics", po::value<std::vector<std::string> >()->multitoken(), "topics to play back")
@@ -646,6 +1325,14 @@ rosbag::PlayerOptions parseOptions(int argc, char **argv) {
 	}
 	if (vm.count("skip-empty"))
 		opts.skip_empty = ros::Duration(vm["skip-empty"].as<float>());
+	if (vm.count("frame-topic"))
+		frame_topic_option = vm["frame-topic"].as<std::string>();
+	if (vm.count("lockstep"))
+		lock_step.enabled = true;
+	if (vm.count("lockstep-timeout"))
+		lock_step.timeout = vm["lockstep-timeout"].as<float>();
+	if (vm.count("read-ahead"))
+		read_ahead_bytes = std::max(vm["read-ahead"].as<float>(), 1.0f) * 1024 * 1024;
 	if (vm.count("loop"))
 		opts.loop = true;
 	if (vm.count("keep-alive"))
@@ -689,12 +1376,17 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
+	// Serves the seek service while the player keeps the main thread
+	ros::AsyncSpinner spinner(1);
+	spinner.start();
+
 	rosbag::Player player(opts);
 
 	try {
 		player.publish();
 	}
 	catch (std::runtime_error &e) {
+		reader.close();
 		ROS_FATAL("%s", e.what());
 		return 1;
 	}
@@ -0,0 +1,130 @@
+#ifndef BALL_SEGMENTATION_BACKGROUND_MODEL_H
+#define BALL_SEGMENTATION_BACKGROUND_MODEL_H
+
+// Running average background used by the colour ball detectors
+// (ball_detection_node and calibration_gui/point_grey_camera).
+
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+// The background is only kept for the rows the detectors look at (from
+// first_row down), as 8.8 fixed point BGR. Every frame it moves towards the
+// current image by learning_rate, except where the detector found the ball,
+// so slow lighting changes no longer need a manual reset.
+// A learning rate of 0 keeps the captured background, as before.
+class BackgroundModel
+{
+public:
+	explicit BackgroundModel(double learning_rate = 0.02) : first_row_(0)
+	{
+		setLearningRate(learning_rate);
+	}
+
+	// learning_rate is clamped to [0, 1] and rounded to a multiple of 1/256,
+	// the step of the 8.8 update: the default 0.02 is applied as 5/256
+	// (0.0195), and rates below 1/512 round to 0 and freeze the background
+	void setLearningRate(double learning_rate)
+	{
+		rate_ = cvRound(std::min(std::max(learning_rate, 0.0), 1.0) * 256);
+	}
+
+	bool empty() const
+	{
+		return acc_.empty();
+	}
+
+	// Capture a new background from bgr, smoothed with a blur_size box
+	void reset(const cv::Mat &bgr, int first_row, int blur_size = 20)
+	{
+		CV_Assert(bgr.type() == CV_8UC3);
+
+		first_row_ = std::min(std::max(first_row, 0), bgr.rows);
+
+		cv::Mat roi;
+		cv::blur(bgr.rowRange(first_row_, bgr.rows), roi, cv::Size(blur_size, blur_size));
+		roi.convertTo(acc_, CV_16UC3, 256);
+	}
+
+	// fg = max(bgr - background, 0) inside roi (the whole modelled region by
+	// default), everything else is cleared. When fg is kept between frames,
+	// stale is the part of it written since the last call (the previous roi
+	// and whatever was drawn on it): only that is cleared instead of the
+	// whole image. An empty stale clears everything outside roi.
+	void subtract(const cv::Mat &bgr, cv::Mat &fg, const cv::Rect &roi = cv::Rect(),
+				  const cv::Rect &stale = cv::Rect()) const
+	{
+		CV_Assert(bgr.type() == CV_8UC3 && bgr.cols == acc_.cols && bgr.rows - first_row_ == acc_.rows);
+
+		cv::Rect r = clip(roi);
+		bool reused = fg.rows == bgr.rows && fg.cols == bgr.cols && fg.type() == CV_8UC3;
+
+		fg.create(bgr.rows, bgr.cols, CV_8UC3);
+		if (r == clip(cv::Rect()))
+			fg.rowRange(0, first_row_).setTo(cv::Scalar::all(0));
+		else if (reused && stale.area() > 0)
+			fg(stale & cv::Rect(0, 0, fg.cols, fg.rows)).setTo(cv::Scalar::all(0));
+		else
+			fg.setTo(cv::Scalar::all(0));
+
+		int n = r.width * 3;
+
+		for (int y = r.y; y < r.y + r.height; y++)
+		{
+			const uchar *src = bgr.ptr<uchar>(y) + 3 * r.x;
+			const ushort *bg = acc_.ptr<ushort>(y - first_row_) + 3 * r.x;
+			uchar *dst = fg.ptr<uchar>(y) + 3 * r.x;
+
+			for (int i = 0; i < n; i++)
+			{
+				int d = src[i] - ((bg[i] + 128) >> 8);
+				dst[i] = d > 0 ? d : 0;
+			}
+		}
+	}
+
+	// Blend bgr into the background inside roi (the whole modelled region by
+	// default). Pixels set in foreground (CV_8UC1, same size as bgr, may be
+	// empty) are left out so the ball is not learned.
+	void update(const cv::Mat &bgr, const cv::Mat &foreground = cv::Mat(), const cv::Rect &roi = cv::Rect())
+	{
+		if (rate_ == 0)
+			return;
+
+		CV_Assert(bgr.type() == CV_8UC3 && bgr.cols == acc_.cols && bgr.rows - first_row_ == acc_.rows);
+
+		cv::Rect r = clip(roi);
+
+		for (int y = r.y; y < r.y + r.height; y++)
+		{
+			const uchar *src = bgr.ptr<uchar>(y) + 3 * r.x;
+			const uchar *skip = foreground.empty() ? 0 : foreground.ptr<uchar>(y);
+			ushort *bg = acc_.ptr<ushort>(y - first_row_) + 3 * r.x;
+
+			for (int x = r.x; x < r.x + r.width; x++, src += 3, bg += 3)
+			{
+				if (skip && skip[x])
+					continue;
+
+				for (int c = 0; c < 3; c++)
+					bg[c] += ((src[c] << 8) - bg[c]) * rate_ / 256;
+			}
+		}
+	}
+
+private:
+	// roi limited to the modelled region, an empty roi selects all of it
+	cv::Rect clip(const cv::Rect &roi) const
+	{
+		cv::Rect all(0, first_row_, acc_.cols, acc_.rows);
+
+		return roi.area() == 0 ? all : roi & all;
+	}
+
+	int rate_;
+	int first_row_;
+	cv::Mat acc_;
+};
+
+#endif
@@ -0,0 +1,334 @@
+#ifndef BALL_SEGMENTATION_HSV_SEGMENTATION_H
+#define BALL_SEGMENTATION_HSV_SEGMENTATION_H
+
+// Colour segmentation shared by the colour ball detectors
+// (ball_detection_node, labelling_node and calibration_gui/point_grey_camera).
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+// Per pixel conversions. Hue is scaled by 1/1.41 so that it fits a uchar,
+// as the detectors have always done (negative hues wrap above 255).
+inline int getH(int r, int g, int b)
+{
+	int max, min, delta;
+
+	if (r >= g && r >= b)
+	{
+		max = r;
+	}
+
+	if (g >= r && g >= b)
+	{
+		max = g;
+	}
+
+	if (b >= r && b >= g)
+	{
+		max = b;
+	}
+
+	if (r <= g && r <= b)
+	{
+		min = r;
+	}
+
+	if (g <= r && g <= b)
+	{
+		min = g;
+	}
+
+	if (b <= r && b <= g)
+	{
+		min = b;
+	}
+
+	delta = max - min;
+
+	if (delta == 0)
+	{
+		return 0;
+	}
+
+	int result;
+
+	if (max == r)
+	{
+		result = (int)((60 / 1.41) * (fmod(((g - b) / (float)delta), 6))) % 256;
+	}
+
+	if (max == g)
+	{
+		result = (int)((60 / 1.41) * (((b - r) / (float)delta + 2))) % 256;
+	}
+
+	if (max == b)
+	{
+		result = (int)((60 / 1.41) * (((r - g) / (float)delta + 4))) % 256;
+	}
+
+	if (result < 0)
+	{
+		return 256 - result;
+	}
+	else
+		return result;
+}
+
+inline int getS(int r, int g, int b)
+{
+	int max = std::max(r, std::max(g, b));
+	int min = std::min(r, std::min(g, b));
+
+	if (max == 0)
+	{
+		return 0;
+	}
+	else
+	{
+		return (int)(((max - min) * 1.0 / max) * 255);
+	}
+}
+
+inline int getV(int r, int g, int b)
+{
+	return std::max(r, std::max(g, b));
+}
+
+// Classifies BGR pixels against a hue band [hue - threshold, hue + threshold]
+// (uchar arithmetic, so the band may wrap around 0) and a minimum value.
+//
+// getH only depends on which channel is the maximum, on the difference of the
+// other two and on max - min, so the band test is precomputed for every
+// (sector, delta, difference) triple. The per pixel cost is then a max/min and
+// one table read instead of a float division and fmod. The table is rebuilt
+// only when the band changes.
+class HueSegmenter
+{
+public:
+	HueSegmenter(uchar hue = 2, uchar threshold = 8, uchar min_value = 10)
+		: hue_(hue), threshold_(threshold), min_value_(min_value), table_(3 * SECTOR_SIZE)
+	{
+		build();
+	}
+
+	void setBand(uchar hue, uchar threshold)
+	{
+		if (hue == hue_ && threshold == threshold_)
+			return;
+
+		hue_ = hue;
+		threshold_ = threshold;
+		build();
+	}
+
+	void setHue(uchar hue)
+	{
+		setBand(hue, threshold_);
+	}
+
+	void setMinValue(uchar min_value)
+	{
+		min_value_ = min_value;
+	}
+
+	uchar hue() const
+	{
+		return hue_;
+	}
+
+	// Same answer as "getV >= min_value && getH inside the band"
+	bool inBand(uchar b, uchar g, uchar r) const
+	{
+		int max = std::max((int)r, std::max((int)g, (int)b));
+
+		if (max < min_value_)
+			return false;
+
+		int delta = max - std::min((int)r, std::min((int)g, (int)b));
+
+		if (delta == 0)
+			return zero_in_band_;
+
+		// getH gives priority to b, then g, then r when several channels tie
+		int sector, num;
+		if (max == b)
+		{
+			sector = 2;
+			num = r - g;
+		}
+		else if (max == g)
+		{
+			sector = 1;
+			num = b - r;
+		}
+		else
+		{
+			sector = 0;
+			num = g - b;
+		}
+
+		return table_[sector * SECTOR_SIZE + delta * delta - 1 + num + delta] != 0;
+	}
+
+	// Writes a CV_8UC1 mask with 255 where the pixel of bgr is in band and 0
+	// elsewhere. Rows above first_row are only cleared.
+	void segment(const cv::Mat &bgr, cv::Mat &mask, int first_row = 0) const
+	{
+		CV_Assert(bgr.type() == CV_8UC3);
+
+		mask.create(bgr.rows, bgr.cols, CV_8UC1);
+		if (first_row > 0)
+			mask.rowRange(0, std::min(first_row, bgr.rows)).setTo(cv::Scalar(0));
+
+		classify(bgr, mask, cv::Rect(0, first_row, bgr.cols, bgr.rows - first_row));
+	}
+
+	// Same, but only the pixels inside roi are classified and the rest of the
+	// mask is cleared. When the mask is kept between frames, only stale (the
+	// roi of the previous call) needs clearing; an empty stale clears it all.
+	void segment(const cv::Mat &bgr, cv::Mat &mask, const cv::Rect &roi, const cv::Rect &stale = cv::Rect()) const
+	{
+		CV_Assert(bgr.type() == CV_8UC3);
+
+		bool reused = mask.rows == bgr.rows && mask.cols == bgr.cols && mask.type() == CV_8UC1;
+
+		mask.create(bgr.rows, bgr.cols, CV_8UC1);
+		if (reused && stale.area() > 0)
+			mask(stale & cv::Rect(0, 0, mask.cols, mask.rows)).setTo(cv::Scalar(0));
+		else
+			mask.setTo(cv::Scalar(0));
+
+		classify(bgr, mask, roi);
+	}
+
+private:
+	// delta = 1..255 and difference = -delta..delta stored as a triangle
+	static const int SECTOR_SIZE = 256 * 256 - 1;
+
+	bool hueInBand(int h) const
+	{
+		uchar hmax = hue_ + threshold_;
+		uchar hmin = hue_ - threshold_;
+
+		if (hmax < hmin)
+			return !(h > (int)hmax && h < (int)hmin);
+		else
+			return !(h > (int)hmax || h < (int)hmin);
+	}
+
+	// getH for a given sector, difference and delta
+	static int sectorHue(int sector, int num, int delta)
+	{
+		int result;
+
+		if (sector == 0)
+			result = (int)((60 / 1.41) * (fmod((num / (float)delta), 6))) % 256;
+		else if (sector == 1)
+			result = (int)((60 / 1.41) * ((num / (float)delta + 2))) % 256;
+		else
+			result = (int)((60 / 1.41) * ((num / (float)delta + 4))) % 256;
+
+		return result < 0 ? 256 - result : result;
+	}
+
+	void classify(const cv::Mat &bgr, cv::Mat &mask, cv::Rect roi) const
+	{
+		roi &= cv::Rect(0, 0, bgr.cols, bgr.rows);
+
+		for (int y = roi.y; y < roi.y + roi.height; y++)
+		{
+			const uchar *src = bgr.ptr<uchar>(y) + 3 * roi.x;
+			uchar *dst = mask.ptr<uchar>(y);
+
+			for (int x = roi.x; x < roi.x + roi.width; x++, src += 3)
+				dst[x] = inBand(src[0], src[1], src[2]) ? 255 : 0;
+		}
+	}
+
+	void build()
+	{
+		zero_in_band_ = hueInBand(0);
+
+		for (int sector = 0; sector < 3; sector++)
+		{
+			uchar *t = &table_[sector * SECTOR_SIZE];
+
+			for (int delta = 1; delta < 256; delta++)
+				for (int num = -delta; num <= delta; num++)
+					t[delta * delta - 1 + num + delta] = hueInBand(sectorHue(sector, num, delta));
+		}
+	}
+
+	uchar hue_;
+	uchar threshold_;
+	uchar min_value_;
+	bool zero_in_band_;
+	std::vector<uchar> table_;
+};
+
+// Neighbour support of a 0/255 mask: number of set pixels in the
+// (2 * radius + 1)^2 window around a pixel, read in constant time from a
+// summed-area table. The table only covers the searched region (the rows from
+// first_row down, or a window) and is kept between frames, so it is
+// reallocated only when that region grows. Windows are clipped at the region
+// borders, hence pixels near them never reach full support.
+class MaskSupport
+{
+public:
+	explicit MaskSupport(int radius = 2) : radius_(radius)
+	{
+	}
+
+	void compute(const cv::Mat &mask, int first_row = 0)
+	{
+		compute(mask, cv::Rect(0, first_row, mask.cols, mask.rows - first_row));
+	}
+
+	void compute(const cv::Mat &mask, const cv::Rect &roi)
+	{
+		CV_Assert(mask.type() == CV_8UC1);
+
+		roi_ = roi & cv::Rect(0, 0, mask.cols, mask.rows);
+		cv::integral(mask(roi_), sum_, CV_32S);
+	}
+
+	int support(int x, int y) const
+	{
+		int x0 = std::max(x - radius_, roi_.x) - roi_.x;
+		int x1 = std::min(x + radius_ + 1, roi_.x + roi_.width) - roi_.x;
+		int y0 = std::max(y - radius_, roi_.y) - roi_.y;
+		int y1 = std::min(y + radius_ + 1, roi_.y + roi_.height) - roi_.y;
+
+		const int *top = sum_.ptr<int>(y0);
+		const int *bottom = sum_.ptr<int>(y1);
+
+		return (bottom[x1] - bottom[x0] - top[x1] + top[x0]) / 255;
+	}
+
+	int area() const
+	{
+		return (2 * radius_ + 1) * (2 * radius_ + 1);
+	}
+
+	bool full(int x, int y) const
+	{
+		return support(x, y) == area();
+	}
+
+	void setRadius(int radius)
+	{
+		radius_ = radius;
+	}
+
+private:
+	int radius_;
+	cv::Rect roi_;
+	cv::Mat sum_;
+};
+
+#endif
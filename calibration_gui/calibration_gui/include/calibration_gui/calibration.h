@@ -41,6 +41,7 @@
 #include <ctime>
 #include <sys/stat.h>
 #include <vector>
+#include <deque>
 #include <numeric> // for mean and standard deviation calculation (accumulate)
 
 // ROS
@@ -78,9 +79,24 @@ string file_path;
 
 #elif defined (_NODE_CPP_)
 extern string file_path;
+/**
+  \struct Stamped
+  \brief Data received from a sensor and the time it was acquired
+ */
+template <class T>
+struct Stamped
+{
+    ros::Time stamp;
+    T data;
+};
+
 /**
   \class CircleCentroids
   \brief Class to handle the ball center coordinates from the different sensors
+
+  The last detections of every sensor are kept with their time stamps, so the ball centers of the
+  different sensors can be paired by time instead of by arrival. This allows acquiring points with a
+  moving ball, at the rate of the sensors.
   \author David Silva
  */
 class CircleCentroids
@@ -88,8 +104,15 @@ class CircleCentroids
 public:
 /**
 @brief Constructor. Subscription of the topics with the ball center coordinates in the different sensors
+@param[in] sensors_list names of the sensors
+@param[in] isCamera true for the sensors that are cameras
+@param[in] history number of detections kept for each sensor
+@param[in] image_history number of full resolution images kept for each camera, they only need to cover
+the detection latency of the sensors
 */
-    CircleCentroids(const vector<string> &sensors_list, const vector<bool> &isCamera)
+    CircleCentroids(const vector<string> &sensors_list, const vector<bool> &isCamera, const int history = 20,
+                    const int image_history = 8)
+    : history_size(std::max(history, 1)), image_history_size(std::max(image_history, 1))
     {
         //Topics I want to subscribe
         //Source: http://ros-users.122217.n3.nabble.com/How-to-identify-the-subscriber-or-the-topic-name-related-to-a-callback-td2391327.html
@@ -99,30 +122,21 @@ public:
         {
           topic_name = "/" + sensors_list[i] + "/BD_" + sensors_list[i] + "/SphereCentroid";
           cout << i << " " << topic_name << endl;
-          pcl::PointXYZ allocator_ball_centers;
-          allocator_ball_centers.x = -999;
-          allocator_ball_centers.y = -999;
-          allocator_ball_centers.z = -999;
-          sensors_ball_centers.push_back(allocator_ball_centers);
+          sensors_ball_centers.push_back(deque<Stamped<pcl::PointXYZ> >());
 
-          subs.push_back( n_.subscribe <geometry_msgs::PointStamped> (topic_name, 1, boost::bind(&CircleCentroids::sensorUpdate, this, _1, i)) );
+          subs.push_back( n_.subscribe <geometry_msgs::PointStamped> (topic_name, 10, boost::bind(&CircleCentroids::sensorUpdate, this, _1, i)) );
         if (isCamera[i])
           {
             // Allocating space in camImage vector
-            cv::Mat allocator_camImage;
-            camImage.push_back(allocator_camImage);
+            camImage.push_back(deque<Stamped<cv::Mat> >());
             // Subscribing to raw image topics
             image_transport::ImageTransport it(n_);
-            subs_cam_images.push_back( it.subscribe ("/" + sensors_list[i] + "/RawImage", 1, boost::bind(&CircleCentroids::imageUpdate, this, _1, cam_count)) );
+            subs_cam_images.push_back( it.subscribe ("/" + sensors_list[i] + "/RawImage", 10, boost::bind(&CircleCentroids::imageUpdate, this, _1, cam_count)) );
 
             // Allocating space in camCentroidPnP vector
-            pcl::PointXYZ allocator_camCentroidPnP;
-            allocator_camCentroidPnP.x = -999;
-            allocator_camCentroidPnP.y = -999;
-            allocator_camCentroidPnP.z = -999;
-            camCentroidPnP.push_back(allocator_camCentroidPnP);
+            camCentroidPnP.push_back(deque<Stamped<pcl::PointXYZ> >());
             //Subscribing to topics containing image points for the solvepnp method
-            subs_pnp.push_back( n_.subscribe <geometry_msgs::PointStamped> (topic_name + "PnP", 1, boost::bind(&CircleCentroids::camCentroidPnPUpdate, this, _1, cam_count)) );
+            subs_pnp.push_back( n_.subscribe <geometry_msgs::PointStamped> (topic_name + "PnP", 10, boost::bind(&CircleCentroids::camCentroidPnPUpdate, this, _1, cam_count)) );
             cout << "/" << sensors_list[i] << "/RawImage" << endl;
             cout << topic_name << "PnP" << endl;
             cam_count++;
@@ -135,18 +149,19 @@ public:
     // Source: https://foundry.supelec.fr/scm/viewvc.php/nouveau/ROS/koala_node/src/camera_position_node.cpp?view=markup&root=rpm_ims&sortdir=down&pathrev=2320
     void sensorUpdate(const geometry_msgs::PointStampedConstPtr& msg, const int i)
     {
-      sensors_ball_centers[i].x = msg->point.x;
-      sensors_ball_centers[i].y = msg->point.y;
-      sensors_ball_centers[i].z = msg->point.z;
+      // -999 means the ball was not found, there is nothing to pair
+      if (msg->point.x == -999)
+        return;
+      push(sensors_ball_centers[i], stampOf(msg->header), pointOf(msg->point), history_size);
       // cout << "sensor callback: " << i << endl; //DEBUG
     }
 
 
     void camCentroidPnPUpdate(const geometry_msgs::PointStampedConstPtr& msg, int camNum)
     {
-        camCentroidPnP[camNum].x = msg->point.x;
-        camCentroidPnP[camNum].y = msg->point.y;
-        camCentroidPnP[camNum].z = msg->point.z;
+        if (msg->point.x == -999)
+          return;
+        push(camCentroidPnP[camNum], stampOf(msg->header), pointOf(msg->point), history_size);
         // cout << "camera callback: " << camNum << endl; //DEBUG
     }
 
@@ -155,7 +170,7 @@ public:
     {
       try
   		{
-  			camImage[camNum] = cv_bridge::toCvCopy(msg, sensor_msgs::image_encodings::BGR8)->image;
+  			push(camImage[camNum], stampOf(msg->header), cv_bridge::toCvCopy(msg, sensor_msgs::image_encodings::BGR8)->image, image_history_size);
         // cout << "image callback: " << camNum << endl; //DEBUG
   		}
   		catch (cv_bridge::Exception &e)
@@ -164,23 +179,140 @@ public:
   		}
     }
 
-    vector<pcl::PointXYZ> getSensorsBallCenters (){ return sensors_ball_centers; }
+/**
+@brief Pairs the newest detection of the reference sensor (the first one) not used yet with the
+detections of the other sensors closest to it in time
+@param[in] tolerance largest time difference, in seconds, between the reference and the other sensors
+@param[out] centers ball center in every sensor, only written when a match is found
+@param[out] centersPnP ball center on the image of every camera, only written when a match is found
+@param[out] images image of every camera, only written when a match is found
+@return bool true if every sensor has a detection within the tolerance
+*/
+    bool getMatchedCentroids(const double tolerance, vector<pcl::PointXYZ> &centers,
+                             vector<pcl::PointXYZ> &centersPnP, vector<cv::Mat> &images)
+    {
+      if (sensors_ball_centers.empty())
+        return false;
+
+      const deque<Stamped<pcl::PointXYZ> > &reference = sensors_ball_centers.front();
+      match_centers.resize(sensors_ball_centers.size());
+      match_pnp.resize(camCentroidPnP.size());
+      match_images.resize(camImage.size());
 
-    vector<pcl::PointXYZ> getCamCentroidPnP (){ return camCentroidPnP; }
+      // Newest first, older detections are only used while the other sensors have not caught up
+      for (int r = reference.size() - 1; r >= 0 && reference[r].stamp > last_match; r--)
+      {
+        const ros::Time &stamp = reference[r].stamp;
+        match_centers.front() = reference[r].data;
 
-    vector<cv::Mat> getCamImage (){ return camImage; }
+        bool matched = true;
+        for (int i = 1; i < sensors_ball_centers.size() && matched; i++)
+          matched = nearest(sensors_ball_centers[i], stamp, tolerance, match_centers[i]);
+        for (int i = 0; i < camCentroidPnP.size() && matched; i++)
+          matched = nearest(camCentroidPnP[i], stamp, tolerance, match_pnp[i]);
+        for (int i = 0; i < camImage.size() && matched; i++)
+          matched = nearest(camImage[i], stamp, tolerance, match_images[i]);
+
+        if (matched)
+        {
+          last_match = stamp;
+          centers = match_centers;
+          centersPnP = match_pnp;
+          images = match_images;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    ros::Time getMatchTime (){ return last_match; }
+
+    vector<pcl::PointXYZ> getSensorsBallCenters (){ return latest(sensors_ball_centers); }
+
+    vector<pcl::PointXYZ> getCamCentroidPnP (){ return latest(camCentroidPnP); }
+
+    vector<cv::Mat> getCamImage ()
+    {
+      vector<cv::Mat> images(camImage.size());
+      for (int i = 0; i < camImage.size(); i++)
+        if (!camImage[i].empty())
+          images[i] = camImage[i].back().data;
+      return images;
+    }
 
   private:
+    static ros::Time stampOf(const std_msgs::Header &header)
+    {
+      // Drivers that do not stamp their messages are paired by arrival time
+      return header.stamp.isZero() ? ros::Time::now() : header.stamp;
+    }
+
+    static pcl::PointXYZ pointOf(const geometry_msgs::Point &p)
+    {
+      return pcl::PointXYZ(p.x, p.y, p.z);
+    }
+
+    template <class T>
+    static void push(deque<Stamped<T> > &ring, const ros::Time &stamp, const T &data, const int size)
+    {
+      // Messages are not always received in order, keep the ring sorted by time
+      typename deque<Stamped<T> >::iterator it = ring.end();
+      while (it != ring.begin() && (it - 1)->stamp > stamp)
+        --it;
+      Stamped<T> sample;
+      sample.stamp = stamp;
+      sample.data = data;
+      ring.insert(it, sample);
+      while (ring.size() > size)
+        ring.pop_front();
+    }
+
+    template <class T>
+    static bool nearest(const deque<Stamped<T> > &ring, const ros::Time &stamp, const double tolerance, T &data)
+    {
+      double best = tolerance;
+      bool found = false;
+      for (int k = ring.size() - 1; k >= 0; k--)
+      {
+        double dt = (ring[k].stamp - stamp).toSec();
+        if (fabs(dt) <= best)
+        {
+          best = fabs(dt);
+          data = ring[k].data;
+          found = true;
+        }
+        else if (dt < -tolerance)
+          break; // sorted, the remaining ones are even older
+      }
+      return found;
+    }
+
+    static vector<pcl::PointXYZ> latest(const vector<deque<Stamped<pcl::PointXYZ> > > &rings)
+    {
+      vector<pcl::PointXYZ> points(rings.size(), pcl::PointXYZ(-999, -999, -999));
+      for (int i = 0; i < rings.size(); i++)
+        if (!rings[i].empty())
+          points[i] = rings[i].back().data;
+      return points;
+    }
+
     ros::NodeHandle n_;
+    int history_size;
+    int image_history_size;
+    ros::Time last_match; /**< time of the last reference detection paired. */
 
     vector<ros::Subscriber> subs;
-    vector<pcl::PointXYZ> sensors_ball_centers;
+    vector<deque<Stamped<pcl::PointXYZ> > > sensors_ball_centers;
 
     vector<ros::Subscriber> subs_pnp;
-    vector<pcl::PointXYZ> camCentroidPnP; /**< ball center coordinates on single camera image. */
+    vector<deque<Stamped<pcl::PointXYZ> > > camCentroidPnP; /**< ball center coordinates on single camera image. */
 
     vector<image_transport::Subscriber> subs_cam_images;
-    vector<cv::Mat> camImage;
+    vector<deque<Stamped<cv::Mat> > > camImage;
+
+    vector<pcl::PointXYZ> match_centers;
+    vector<pcl::PointXYZ> match_pnp;
+    vector<cv::Mat> match_images;
 };
 
 #else
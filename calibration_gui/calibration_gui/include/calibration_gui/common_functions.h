@@ -42,7 +42,7 @@
 #include <string>
 #include "lidar_segmentation/lidar_segmentation.h"
 
-#if !defined _LDMRS_VISUALIZATION_RVIZ_CPP_ && !defined _VLP_VISUALIZATION_RVIZ_CPP_
+#if !defined _LDMRS_VISUALIZATION_RVIZ_CPP_ && !defined _VLP_VISUALIZATION_RVIZ_CPP_ && !defined _COMMON_FUNCTIONS_CPP_
 double BALL_DIAMETER;
 #endif
 
@@ -81,7 +81,35 @@ public:
 };
 typedef boost::shared_ptr<LidarClusters> LidarClustersPtr;
 
+/**
+  \class CircleDetector
+  \brief Detection of the ball section in a laser cluster with the inscribed angle test of Xavier et al.
+
+  Every point between the first and the last one of the cluster sees the chord between them under
+  the same angle when the cluster is an arc of a circle. The mean and standard deviation of that
+  angle are accumulated in a single pass and the circle is then fitted with CalculateCircle.
+ */
+class CircleDetector
+{
+public:
+    int min_span;       // minimum index distance between the first and the last point
+    double min_angle;   // lower bound of the mean inscribed angle, in degrees
+    double max_angle;   // upper bound of the mean inscribed angle, in degrees
+    double max_std;     // upper bound of the standard deviation of the inscribed angle, in degrees
+    double max_extent;  // clusters with a bounding box side larger than this are rejected, 0 disables the test
+
+    CircleDetector(int span, double min_ang, double max_ang, double std_limit, double extent=0)
+    : min_span(span), min_angle(min_ang), max_angle(max_ang), max_std(std_limit), max_extent(extent)
+    {}
+
+    bool angleStatistics(ClusterPtr cluster, double& mean, double& deviation) const;
+    bool detect(ClusterPtr cluster, double tilt, double& R, Point& center) const;
+};
+
+
 void circlePoints(vector<ClusterPtr>& circle_points, double radius, double centre[3], int number_points);
+void scanClustering(const vector<PointPtr>& points, double threshold, vector<ClusterPtr>& clusters);
+void gridClustering(const vector<PointPtr>& points, double threshold, vector<ClusterPtr>& clusters);
 void CalculateCircle(ClusterPtr cluster, double& R, Point& Center);
 void convertDataToXY(sensor_msgs::LaserScan scan, C_DataFromFilePtr& data_gt);
 #endif
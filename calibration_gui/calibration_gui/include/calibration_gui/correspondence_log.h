@@ -0,0 +1,226 @@
+/**************************************************************************************************
+ Software License Agreement (BSD License)
+
+ Copyright (c) 2014-2015, LAR toolkit developers - University of Aveiro - http://lars.mec.ua.pt
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted
+ provided that the following conditions are met:
+
+  *Redistributions of source code must retain the above copyright notice, this list of
+   conditions and the following disclaimer.
+  *Redistributions in binary form must reproduce the above copyright notice, this list of
+   conditions and the following disclaimer in the documentation and/or other materials provided
+   with the distribution.
+  *Neither the name of the University of Aveiro nor the names of its contributors may be used to
+   endorse or promote products derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************************************/
+/**
+\file  correspondence_log.h
+\brief Append-only binary log of the ball centers acquired during the calibration
+*/
+
+#ifndef _CORRESPONDENCE_LOG_H_
+#define _CORRESPONDENCE_LOG_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include "ros/ros.h"
+#include <pcl/point_types.h>
+#include <opencv2/highgui/highgui.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+/**
+  \class CorrespondenceLog
+  \brief Writes one record per acquired point, and the camera images, on a background thread
+
+  File layout, little endian as written by the machine:
+  - header: "CALIBLOG", uint32 version, uint32 number of sensors, uint32 number of cameras, and for
+    every sensor an uint32 length followed by its name
+  - records: int32 point number, double time stamp, then x y z as floats for every sensor followed
+    by x y z for the PnP center of every camera
+
+  Every record is flushed once written, so the log of an interrupted session can still be read.
+ */
+class CorrespondenceLog
+{
+public:
+	CorrespondenceLog()
+	: file_(NULL), sensors_(0), cameras_(0), stop_(false)
+	{}
+
+	~CorrespondenceLog() { close(); }
+
+/**
+	@brief Create the log file and start the writer thread
+	@param[in] path file to create
+	@param[in] sensors names of the sensors, in the order of the records
+	@param[in] cameras number of cameras
+	@return bool false if the file could not be created
+*/
+	bool open(const std::string& path, const std::vector<std::string>& sensors, int cameras)
+	{
+		close();
+		file_ = fopen(path.c_str(), "wb");
+		if(!file_)
+		{
+			ROS_ERROR("Could not create %s", path.c_str());
+			return false;
+		}
+
+		sensors_ = sensors.size();
+		cameras_ = cameras;
+		uint32_t header[3] = {1, (uint32_t)sensors_, (uint32_t)cameras_};
+		fwrite("CALIBLOG", 1, 8, file_);
+		fwrite(header, sizeof(uint32_t), 3, file_);
+		for(int i=0; i<sensors.size(); i++)
+		{
+			uint32_t length = sensors[i].size();
+			fwrite(&length, sizeof(uint32_t), 1, file_);
+			fwrite(sensors[i].data(), 1, length, file_);
+		}
+		fflush(file_);
+
+		stop_ = false;
+		thread_ = boost::thread(boost::bind(&CorrespondenceLog::writer, this));
+		return true;
+	}
+
+/**
+	@brief Queue the record of an acquired point
+	@param[in] point number of the point
+	@param[in] stamp time of the detections
+	@param[in] centers ball center in every sensor
+	@param[in] centersPnP ball center on the image of every camera
+	@return void
+*/
+	void append(int point, const ros::Time& stamp, const std::vector<pcl::PointXYZ>& centers,
+	            const std::vector<pcl::PointXYZ>& centersPnP)
+	{
+		if(!file_)
+			return;
+
+		Job job;
+		job.record.resize(sizeof(int32_t) + sizeof(double) + 3*sizeof(float)*(sensors_+cameras_), 0);
+		char* out = &job.record[0];
+		int32_t number = point;
+		double seconds = stamp.toSec();
+		memcpy(out, &number, sizeof(number));
+		memcpy(out+sizeof(number), &seconds, sizeof(seconds));
+
+		// Missing entries are left as zeros, the record size never changes
+		float* xyz = (float*)(out + sizeof(number) + sizeof(seconds));
+		for(int i=0; i<sensors_ && i<centers.size(); i++)
+			memcpy(xyz + 3*i, centers[i].data, 3*sizeof(float));
+		xyz += 3*sensors_;
+		for(int i=0; i<cameras_ && i<centersPnP.size(); i++)
+			memcpy(xyz + 3*i, centersPnP[i].data, 3*sizeof(float));
+		push(job);
+	}
+
+/**
+	@brief Queue a camera image to be encoded and saved
+	@param[in] path image file, the extension selects the format
+	@param[in] image image to save, it must not be modified afterwards
+	@return void
+*/
+	void saveImage(const std::string& path, const cv::Mat& image)
+	{
+		if(!file_ || image.empty())
+			return;
+
+		Job job;
+		job.path = path;
+		job.image = image;
+		push(job);
+	}
+
+/**
+	@brief Write everything still queued, stop the writer thread and close the file
+	@return void
+*/
+	void close()
+	{
+		if(!file_)
+			return;
+		{
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		cv_.notify_all();
+		thread_.join();
+		fclose(file_);
+		file_ = NULL;
+	}
+
+private:
+	struct Job
+	{
+		std::vector<char> record;
+		std::string path;
+		cv::Mat image;
+	};
+
+	void push(const Job& job)
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			queue_.push_back(job);
+		}
+		cv_.notify_one();
+	}
+
+	void writer()
+	{
+		std::deque<Job> jobs;
+		boost::unique_lock<boost::mutex> lock(mutex_);
+		while(true)
+		{
+			while(!stop_ && queue_.empty())
+				cv_.wait(lock);
+			if(queue_.empty())
+				return;
+
+			jobs.swap(queue_);
+			lock.unlock();
+			for(int k=0; k<jobs.size(); k++)
+			{
+				if(!jobs[k].record.empty())
+				{
+					fwrite(&jobs[k].record[0], 1, jobs[k].record.size(), file_);
+					fflush(file_);
+				}
+				else if(!cv::imwrite(jobs[k].path, jobs[k].image))
+					ROS_ERROR("Could not save %s", jobs[k].path.c_str());
+			}
+			jobs.clear();
+			lock.lock();
+		}
+	}
+
+	FILE* file_;
+	int sensors_;
+	int cameras_;
+
+	boost::thread thread_;
+	boost::mutex mutex_;
+	boost::condition_variable cv_;
+	std::deque<Job> queue_;
+	bool stop_;
+};
+
+#endif
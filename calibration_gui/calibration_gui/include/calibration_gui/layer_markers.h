@@ -0,0 +1,242 @@
+/**************************************************************************************************
+ Software License Agreement (BSD License)
+
+ Copyright (c) 2014-2015, LAR toolkit developers - University of Aveiro - http://lars.mec.ua.pt
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted
+ provided that the following conditions are met:
+
+  *Redistributions of source code must retain the above copyright notice, this list of
+   conditions and the following disclaimer.
+  *Redistributions in binary form must reproduce the above copyright notice, this list of
+   conditions and the following disclaimer in the documentation and/or other materials provided
+   with the distribution.
+  *Neither the name of the University of Aveiro nor the names of its contributors may be used to
+   endorse or promote products derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************************************/
+/**
+\file  layer_markers.h
+\brief Builder of the rviz markers of the multi-layer lasers, one marker per layer and kind
+*/
+
+#ifndef _LAYER_MARKERS_H_
+#define _LAYER_MARKERS_H_
+
+#include <ros/ros.h>
+#include <visualization_msgs/Marker.h>
+#include <visualization_msgs/MarkerArray.h>
+#include <std_msgs/ColorRGBA.h>
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+  \class LayerMarkers
+  \brief Builds the marker array of a laser with any number of layers and keeps its storage between scans
+
+  Each family is a kind of marker (cluster points, circle lines...) with one marker per layer, named
+  after the family and the layer number. Text labels are added per layer with their own ids. The
+  markers, their point arrays and the array published are all reused, so once the first scans
+  have grown them a new scan costs no allocation. Markers published in the previous scan and not
+  in this one are deleted, as the Markers class did.
+ */
+class LayerMarkers
+{
+public:
+	explicit LayerMarkers(const std::string& frame_id)
+	: frame_id_(frame_id), labels_used_(0)
+	{}
+
+/**
+	@brief Add a family of markers
+	@param[in] ns namespace, suffixed with the layer number unless the family is not layered
+	@param[in] type visualization_msgs::Marker type
+	@param[in] scale marker scale on all axes (point size, line width or text height)
+	@param[in] color colour of the markers, per point colours are pushed in the marker itself
+	@param[in] layered one marker per layer, or a single marker
+	@return int family index
+*/
+	int addFamily(const std::string& ns, int type, double scale, const std_msgs::ColorRGBA& color, bool layered=true)
+	{
+		Family family;
+		family.ns=ns;
+		family.type=type;
+		family.scale=scale;
+		family.color=color;
+		family.layered=layered;
+		families_.push_back(family);
+		return families_.size()-1;
+	}
+
+	int families() const { return families_.size(); }
+
+/**
+	@brief Start the markers of a new scan, the points of the previous one are cleared
+	@param[in] layers number of layers of the scan
+	@return void
+*/
+	void begin(int layers)
+	{
+		stamp_=ros::Time::now();
+		for(size_t f=0; f<families_.size(); f++)
+		{
+			Family& family = families_[f];
+			size_t count = family.layered ? layers : 1;
+			size_t first = std::min(count, family.markers.size());
+			family.markers.resize(count);
+			for(size_t l=first; l<count; l++)
+				init(family.markers[l], family, family.layered ? layerName(family.ns, l) : family.ns, 0);
+			for(size_t l=0; l<count; l++)
+			{
+				family.markers[l].header.stamp=stamp_;
+				family.markers[l].points.clear();
+				family.markers[l].colors.clear();
+			}
+		}
+		labels_used_=0;
+	}
+
+/**
+	@brief Marker of a family for a layer, points are pushed straight into it
+	@param[in] family family index
+	@param[in] layer layer index, 0 for families that are not layered
+	@return visualization_msgs::Marker&
+*/
+	visualization_msgs::Marker& marker(int family, int layer=0)
+	{
+		return families_[family].markers[layer];
+	}
+
+/**
+	@brief Add a text label with a number to a layer
+	@param[in] family family of the label, TEXT_VIEW_FACING
+	@param[in] layer layer index
+	@param[in] id marker id, labels of a layer are told apart by it
+	@param[in] x,y,z label position
+	@param[in] number text of the label
+	@return void
+*/
+	void addLabel(int family, int layer, int id, double x, double y, double z, int number)
+	{
+		if(labels_used_==labels_.size())
+			labels_.push_back(visualization_msgs::Marker());
+
+		const Family& f = families_[family];
+		visualization_msgs::Marker& label = labels_[labels_used_++];
+		init(label, f, f.layered ? layerName(f.ns, layer) : f.ns, id);
+		label.pose.position.x=x;
+		label.pose.position.y=y;
+		label.pose.position.z=z;
+
+		char text[16];
+		snprintf(text, sizeof(text), "%d", number);
+		label.text=text;
+	}
+
+/**
+	@brief Markers of the scan, the empty ones are left out and the ones gone since the last scan deleted
+	@return const visualization_msgs::MarkerArray&
+*/
+	const visualization_msgs::MarkerArray& end()
+	{
+		size_t n=0;
+		current_.clear();
+		for(size_t f=0; f<families_.size(); f++)
+			for(size_t l=0; l<families_[f].markers.size(); l++)
+				if(!families_[f].markers[l].points.empty())
+					put(families_[f].markers[l], n);
+		for(size_t i=0; i<labels_used_; i++)
+			put(labels_[i], n);
+
+		std::sort(current_.begin(), current_.end());
+		for(size_t i=0; i<published_.size(); i++)
+		{
+			if(std::binary_search(current_.begin(), current_.end(), published_[i]))
+				continue;
+			deleted_.header.frame_id=frame_id_;
+			deleted_.header.stamp=stamp_;
+			deleted_.ns=published_[i].first;
+			deleted_.id=published_[i].second;
+			deleted_.action=visualization_msgs::Marker::DELETE;
+			if(n<array_.markers.size())
+				array_.markers[n]=deleted_;
+			else
+				array_.markers.push_back(deleted_);
+			n++;
+		}
+
+		array_.markers.resize(n);
+		published_.swap(current_);
+		return array_;
+	}
+
+private:
+	typedef std::pair<std::string,int> Key;
+
+	struct Family
+	{
+		std::string ns;
+		int type;
+		double scale;
+		std_msgs::ColorRGBA color;
+		bool layered;
+		std::vector<visualization_msgs::Marker> markers;
+	};
+
+	static std::string layerName(const std::string& ns, int layer)
+	{
+		char number[16];
+		snprintf(number, sizeof(number), "%d", layer);
+		return ns+number;
+	}
+
+	void init(visualization_msgs::Marker& marker, const Family& family, const std::string& ns, int id)
+	{
+		marker.header.frame_id=frame_id_;
+		marker.header.stamp=stamp_;
+		marker.ns=ns;
+		marker.id=id;
+		marker.type=family.type;
+		marker.action=visualization_msgs::Marker::ADD;
+		marker.pose.orientation.w=1.0;
+		marker.scale.x=family.scale;
+		marker.scale.y=family.scale;
+		marker.scale.z=family.scale;
+		marker.color=family.color;
+	}
+
+	// Copy into the published array, vector assignment keeps the capacity of the slot
+	void put(const visualization_msgs::Marker& marker, size_t& n)
+	{
+		if(n<array_.markers.size())
+			array_.markers[n]=marker;
+		else
+			array_.markers.push_back(marker);
+		n++;
+		current_.push_back(Key(marker.ns, marker.id));
+	}
+
+	std::string frame_id_;
+	ros::Time stamp_;
+	std::vector<Family> families_;
+	std::vector<visualization_msgs::Marker> labels_;
+	size_t labels_used_;
+	visualization_msgs::Marker deleted_;
+	std::vector<Key> current_;
+	std::vector<Key> published_;
+	visualization_msgs::MarkerArray array_;
+};
+
+#endif
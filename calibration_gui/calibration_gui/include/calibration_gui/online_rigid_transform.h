@@ -0,0 +1,163 @@
+/**************************************************************************************************
+ Software License Agreement (BSD License)
+
+ Copyright (c) 2014-2015, LAR toolkit developers - University of Aveiro - http://lars.mec.ua.pt
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted
+ provided that the following conditions are met:
+
+  *Redistributions of source code must retain the above copyright notice, this list of
+   conditions and the following disclaimer.
+  *Redistributions in binary form must reproduce the above copyright notice, this list of
+   conditions and the following disclaimer in the documentation and/or other materials provided
+   with the distribution.
+  *Neither the name of the University of Aveiro nor the names of its contributors may be used to
+   endorse or promote products derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************************************/
+/**
+\file  online_rigid_transform.h
+\brief Rigid transformation between two sensors updated with every acquired pair of ball centers
+*/
+
+#ifndef _ONLINE_RIGID_TRANSFORM_H_
+#define _ONLINE_RIGID_TRANSFORM_H_
+
+#include <cmath>
+#include <algorithm>
+#include <eigen3/Eigen/Dense>
+#include <pcl/point_types.h>
+#include <geometry_msgs/Pose.h>
+
+/**
+  \class OnlineRigidTransform
+  \brief Least squares rigid transformation from running sums of the point pairs
+
+  Only the centroid sums, the cross-covariance and the squared norms of the points are kept, so
+  adding a pair and refreshing the transformation and its residual costs the same whatever the
+  number of pairs. The solution is the same as the SVD method of estimateTransformation.
+ */
+class OnlineRigidTransform
+{
+public:
+	OnlineRigidTransform() { reset(); }
+
+/**
+	@brief Forget every pair
+	@return void
+*/
+	void reset()
+	{
+		n_=0;
+		sum_source_.setZero();
+		sum_target_.setZero();
+		sum_cross_.setZero();
+		sum_squared_=0;
+		transformation_.setIdentity();
+		residual_=0;
+	}
+
+/**
+	@brief Add a pair of ball centers and refresh the transformation
+	@param[in] source ball center in the sensor being calibrated
+	@param[in] target ball center in the reference sensor
+	@return void
+*/
+	void add(const pcl::PointXYZ& source, const pcl::PointXYZ& target)
+	{
+		Eigen::Vector3d s(source.x, source.y, source.z);
+		Eigen::Vector3d t(target.x, target.y, target.z);
+		n_++;
+		sum_source_+=s;
+		sum_target_+=t;
+		sum_cross_+=s*t.transpose();
+		sum_squared_+=s.squaredNorm()+t.squaredNorm();
+		update();
+	}
+
+	int size() const { return n_; }
+
+/**
+	@brief The transformation is only defined with three pairs or more
+	@return bool
+*/
+	bool valid() const { return n_>=3; }
+
+/**
+	@brief Transformation that takes the source points to the reference sensor
+	@return const Eigen::Matrix4d&
+*/
+	const Eigen::Matrix4d& transformation() const { return transformation_; }
+
+/**
+	@brief Root mean square distance, in meters, between the transformed source points and the target points
+	@return double
+*/
+	double residual() const { return residual_; }
+
+/**
+	@brief Transformation as a pose, the way the calibrated sensors are displayed
+	@param[out] pose position and orientation of the sensor in the reference sensor
+	@return void
+*/
+	void pose(geometry_msgs::Pose& pose) const
+	{
+		Eigen::Quaterniond q(Eigen::Matrix3d(transformation_.block<3,3>(0,0)));
+		pose.position.x=transformation_(0,3);
+		pose.position.y=transformation_(1,3);
+		pose.position.z=transformation_(2,3);
+		pose.orientation.x=q.x();
+		pose.orientation.y=q.y();
+		pose.orientation.z=q.z();
+		pose.orientation.w=q.w();
+	}
+
+private:
+	void update()
+	{
+		if(!valid())
+			return;
+
+		Eigen::Vector3d cs=sum_source_/n_;
+		Eigen::Vector3d ct=sum_target_/n_;
+		Eigen::Matrix3d H=sum_cross_-n_*cs*ct.transpose();
+
+		Eigen::JacobiSVD<Eigen::Matrix3d> svd(H, Eigen::ComputeFullU | Eigen::ComputeFullV);
+		Eigen::Matrix3d R=svd.matrixV()*svd.matrixU().transpose();
+		if(R.determinant()<0)
+		{
+			// Reflection, flip the axis of the smallest singular value
+			Eigen::Matrix3d V=svd.matrixV();
+			V.col(2)*=-1;
+			R=V*svd.matrixU().transpose();
+		}
+
+		transformation_.setIdentity();
+		transformation_.block<3,3>(0,0)=R;
+		transformation_.block<3,1>(0,3)=ct-R*cs;
+
+		// sum |(t-ct) - R(s-cs)|^2 = sum |s-cs|^2 + sum |t-ct|^2 - 2 trace(R H)
+		double centred=sum_squared_-n_*(cs.squaredNorm()+ct.squaredNorm());
+		double error=centred-2*(R*H).trace();
+		residual_=sqrt(std::max(error,0.0)/n_);
+	}
+
+	int n_;
+	Eigen::Vector3d sum_source_;
+	Eigen::Vector3d sum_target_;
+	Eigen::Matrix3d sum_cross_;
+	double sum_squared_;
+	Eigen::Matrix4d transformation_;
+	double residual_;
+};
+
+#endif
@@ -0,0 +1,218 @@
+/**************************************************************************************************
+ Software License Agreement (BSD License)
+
+ Copyright (c) 2014-2015, LAR toolkit developers - University of Aveiro - http://lars.mec.ua.pt
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted
+ provided that the following conditions are met:
+
+  *Redistributions of source code must retain the above copyright notice, this list of
+   conditions and the following disclaimer.
+  *Redistributions in binary form must reproduce the above copyright notice, this list of
+   conditions and the following disclaimer in the documentation and/or other materials provided
+   with the distribution.
+  *Neither the name of the University of Aveiro nor the names of its contributors may be used to
+   endorse or promote products derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************************************/
+/**
+\file  organized_sphere_search.h
+\brief Ball detection on organized point clouds (Kinect, SwissRanger) seen as depth images
+*/
+
+#ifndef _ORGANIZED_SPHERE_SEARCH_H_
+#define _ORGANIZED_SPHERE_SEARCH_H_
+
+#include "ros/ros.h"
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <eigen3/Eigen/Dense>
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include "calibration_gui/sphere_fitter.h"
+
+/**
+  \class OrganizedSphereSearch
+  \brief Finds the ball in an organized cloud by fitting spheres only on compact depth blobs
+
+  The cloud is walked as a depth image: neighbouring pixels whose range differs by more than a
+  fraction of the range belong to different blobs. Blobs whose size matches the ball are the
+  candidates, and a sphere is fitted on each of them (a few hundred points) instead of on the whole
+  cloud. The fitter starts from the last accepted sphere, and the blob closest to it is tried first.
+  The time budget of the fitter holds for the whole frame, not for each blob.
+ */
+class OrganizedSphereSearch
+{
+public:
+	bool enabled;
+	double ball_diameter;
+	double depth_jump;          // relative range difference that separates two blobs
+	int min_points;             // smallest blob, in sampled pixels
+	int step;                   // sampling step in pixels, along rows and columns
+	int max_candidates;         // blobs fitted per frame
+	SphereFitter fitter;
+
+	OrganizedSphereSearch()
+	: enabled(true), ball_diameter(0), depth_jump(0.04), min_points(30), step(1), max_candidates(8)
+	{}
+
+/**
+	@brief Read the parameters of the search, the current values are the defaults
+	@param[in] nh private node handle
+	@return void
+*/
+	void readParameters(ros::NodeHandle& nh)
+	{
+		nh.param("organizedSearch", enabled, enabled);
+		nh.param("blobDepthJump", depth_jump, depth_jump);
+		nh.param("blobMinPoints", min_points, min_points);
+		nh.param("blobStep", step, step);
+		nh.param("blobCandidates", max_candidates, max_candidates);
+		step=std::max(step,1);
+
+		// +- 5% of BALL_DIAMETER is admissable
+		fitter.radius = ball_diameter/2;
+		fitter.radius_tolerance = 0.05*ball_diameter/2;
+		fitter.readParameters(nh, "blobSphere");
+	}
+
+/**
+	@brief Look for the ball in the cloud
+	@param[in] cloud organized point cloud
+	@param[out] sphere fitted sphere and its quality
+	@return bool true if the ball was found
+*/
+	bool detect(const pcl::PointCloud<pcl::PointXYZ>& cloud, SphereFit& sphere)
+	{
+		sphere = SphereFit();
+		if(cloud.height<=1 || ball_diameter<=0)
+			return false;
+
+		ros::WallTime start = ros::WallTime::now();
+		findBlobs(cloud);
+
+		// Warm start: the blob closest to the last sphere goes first
+		std::vector<std::pair<double,int> > order(blobs_.size());
+		for(int b=0; b<blobs_.size(); b++)
+		{
+			double key = -(double)blobs_[b].indices.size();
+			if(fitter.hasLast())
+				key = (blobs_[b].centroid-fitter.lastCenter()).squaredNorm();
+			order[b]=std::make_pair(key,b);
+		}
+		std::sort(order.begin(),order.end());
+
+		double budget = fitter.time_budget;
+		int tries = std::min((int)order.size(), max_candidates);
+		bool found = false;
+		for(int k=0; k<tries && !found; k++)
+		{
+			double elapsed = (ros::WallTime::now()-start).toSec();
+			if(budget>0 && elapsed>=budget)
+				break;
+			if(budget>0)
+				fitter.time_budget = budget-elapsed;
+			found = fitter.fit(cloud, &blobs_[order[k].second].indices, sphere);
+		}
+		fitter.time_budget = budget;
+		sphere.seconds = (ros::WallTime::now()-start).toSec();
+		return found;
+	}
+
+private:
+	struct Blob
+	{
+		std::vector<int> indices;
+		Eigen::Vector3f centroid;
+	};
+
+	bool valid(const pcl::PointXYZ& p) const
+	{
+		return pcl_isfinite(p.x) && pcl_isfinite(p.y) && pcl_isfinite(p.z) && (p.x!=0 || p.y!=0 || p.z!=0);
+	}
+
+/**
+	@brief Label the sampled depth image in 4-connected blobs and keep the ones of the ball size
+	@param[in] cloud organized point cloud
+	@return void
+*/
+	void findBlobs(const pcl::PointCloud<pcl::PointXYZ>& cloud)
+	{
+		int cols = (cloud.width+step-1)/step;
+		int rows = (cloud.height+step-1)/step;
+		int cells = cols*rows;
+
+		range_.assign(cells,-1);
+		for(int r=0; r<rows; r++)
+			for(int c=0; c<cols; c++)
+			{
+				const pcl::PointXYZ& p = cloud.points[r*step*cloud.width + c*step];
+				if(valid(p))
+					range_[r*cols+c] = sqrt(p.x*p.x + p.y*p.y + p.z*p.z);
+			}
+
+		label_.assign(cells,0);
+		blobs_.clear();
+		double max_extent = 1.25*ball_diameter;
+		double min_extent = 0.4*ball_diameter;
+
+		for(int seed=0; seed<cells; seed++)
+		{
+			if(range_[seed]<0 || label_[seed])
+				continue;
+
+			Blob blob;
+			Eigen::Vector3f lo(1e9,1e9,1e9), hi(-1e9,-1e9,-1e9), sum(0,0,0);
+			stack_.clear();
+			stack_.push_back(seed);
+			label_[seed]=1;
+			while(!stack_.empty())
+			{
+				int cell = stack_.back();
+				stack_.pop_back();
+				int r = cell/cols, c = cell%cols;
+				int index = r*step*cloud.width + c*step;
+				Eigen::Vector3f p = cloud.points[index].getVector3fMap();
+				blob.indices.push_back(index);
+				lo=lo.cwiseMin(p);
+				hi=hi.cwiseMax(p);
+				sum+=p;
+
+				double jump = depth_jump*range_[cell];
+				int neighbours[4] = {c>0 ? cell-1 : -1, c<cols-1 ? cell+1 : -1, r>0 ? cell-cols : -1, r<rows-1 ? cell+cols : -1};
+				for(int k=0; k<4; k++)
+				{
+					int n = neighbours[k];
+					if(n<0 || label_[n] || range_[n]<0 || fabs(range_[n]-range_[cell])>jump)
+						continue;
+					label_[n]=1;
+					stack_.push_back(n);
+				}
+			}
+
+			Eigen::Vector3f extent = hi-lo;
+			if(blob.indices.size()<min_points || extent.maxCoeff()>max_extent || extent.head<2>().maxCoeff()<min_extent)
+				continue;
+
+			blob.centroid = sum/blob.indices.size();
+			blobs_.push_back(blob);
+		}
+	}
+
+	std::vector<Blob> blobs_;
+	std::vector<float> range_;
+	std::vector<char> label_;
+	std::vector<int> stack_;
+};
+
+#endif
@@ -78,6 +78,7 @@ public:
 	ros::NodeHandle n_;
 	image_transport::Subscriber subs_cam_image;
 	Mat camImage;
+	ros::Time stamp; /**< acquisition time of camImage. */
 
 /**
 	@brief Constructor. Subscription to the topic that contains the images acquired from the Point Grey camera.
@@ -99,6 +100,7 @@ public:
 		try
 		{
 			camImage = cv_bridge::toCvCopy(msg, sensor_msgs::image_encodings::BGR8)->image;
+			stamp = msg->header.stamp;
 		}
 		catch (cv_bridge::Exception &e)
 		{
@@ -110,13 +112,13 @@ public:
 
 void CreateTrackbarsAndWindows ();
 
-void ImageProcessing(Mat &img);
+void ImageProcessing(Mat &img, const ros::Time &stamp);
 
 void HoughDetection(const Mat &img, const Mat& imgBinary );
 
 void PolygonalCurveDetection( Mat &img, Mat &imgBinary );
 
-void CentroidPub( const pcl::PointXYZ centroid, const pcl::PointXYZ centroidRadius );
+void CentroidPub( const pcl::PointXYZ centroid, const pcl::PointXYZ centroidRadius, const ros::Time &stamp );
 
 void setLabel(cv::Mat& im, const std::string label, std::vector<cv::Point>& contour);
 
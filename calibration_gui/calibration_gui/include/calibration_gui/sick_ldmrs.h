@@ -148,7 +148,7 @@ public:
     }
 };
 
-double find_circle(vector<ClusterPtr> clusters, vector<ClusterPtr>& circleP, int layer);
+double find_circle(vector<ClusterPtr> clusters, vector<ClusterPtr>& circleP, int layer, geometry_msgs::Point& center);
 void calculateSphereCentroid(vector<geometry_msgs::Point> center, geometry_msgs::PointStamped &sphereCentroid, vector<double> radius);
 void rotatePoints(double& x,double& y, double& z, double angle);
 void convertDataToXYZ(sensor_msgs::LaserScan scan, vector<C_DataFromFilePtr>& data_gt, double rot);
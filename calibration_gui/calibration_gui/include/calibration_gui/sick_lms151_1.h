@@ -55,5 +55,5 @@
 #include <sensor_msgs/LaserScan.h>
 #include "lidar_segmentation/lidar_segmentation.h"
 
-double find_circle(vector<ClusterPtr> clusters, vector<ClusterPtr>& circleP, Point & sphere);
+double find_circle(vector<ClusterPtr> clusters, vector<ClusterPtr>& circleP, Point & sphere, const ros::Time& stamp);
 #endif
@@ -0,0 +1,352 @@
+/**************************************************************************************************
+ Software License Agreement (BSD License)
+
+ Copyright (c) 2014-2015, LAR toolkit developers - University of Aveiro - http://lars.mec.ua.pt
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted
+ provided that the following conditions are met:
+
+  *Redistributions of source code must retain the above copyright notice, this list of
+   conditions and the following disclaimer.
+  *Redistributions in binary form must reproduce the above copyright notice, this list of
+   conditions and the following disclaimer in the documentation and/or other materials provided
+   with the distribution.
+  *Neither the name of the University of Aveiro nor the names of its contributors may be used to
+   endorse or promote products derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************************************/
+/**
+\file  sphere_fitter.h
+\brief Sphere fitting shared by the 3D sensors (Kinect, SwissRanger, Velodyne)
+*/
+
+#ifndef _SPHERE_FITTER_H_
+#define _SPHERE_FITTER_H_
+
+#include "ros/ros.h"
+#include <cmath>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <eigen3/Eigen/Dense>
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
+/**
+  \class SphereFit
+  \brief Result and quality of a sphere fit
+ */
+class SphereFit
+{
+public:
+	bool valid;             // the sphere passed the radius and inlier tests
+	Eigen::Vector3f center;
+	float radius;
+	int points;             // points offered to the fit
+	int inliers;            // points closer than the distance threshold to the sphere
+	double rms;             // root mean square distance of the inliers to the sphere
+	int iterations;         // RANSAC iterations, 0 when the closed form fit was enough
+	bool warm_start;        // the previous sphere was the starting point
+	double seconds;         // time spent in the fit
+
+	SphereFit()
+	: valid(false), center(0,0,0), radius(0), points(0), inliers(0), rms(0), iterations(0), warm_start(false), seconds(0)
+	{}
+
+	double inlierRatio() const { return points ? (double)inliers/points : 0; }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const SphereFit& fit)
+{
+	os << "center " << fit.center.transpose() << " radius " << fit.radius << " inliers " << fit.inliers << "/" << fit.points
+	   << " rms " << fit.rms << " iterations " << fit.iterations << (fit.warm_start ? " warm" : "") << " " << fit.seconds*1e3 << " msec";
+	return os;
+}
+
+/**
+  \class SphereFitter
+  \brief Bounded time sphere fitting: previous sphere, then algebraic least squares, then RANSAC
+
+  The sphere x²+y²+z² = 2ax + 2by + 2cz + d is linear in (a, b, c, d), so a least squares fit is a
+  4x4 system accumulated in one pass over the points. When the candidate points are mostly the ball
+  that fit is the answer, and RANSAC over 4 point samples is only run when it is not. RANSAC stops
+  at max_iterations, at the time budget, or when the best sphere makes more samples pointless.
+ */
+class SphereFitter
+{
+public:
+	double radius;              // expected radius
+	double radius_tolerance;    // accepted difference to the expected radius
+	double sample_tolerance;    // radius difference accepted for the RANSAC samples
+	double distance_threshold;  // inlier distance to the sphere surface
+	double min_inlier_ratio;    // inliers over points needed to accept the sphere
+	int min_inliers;            // inliers needed to accept the sphere
+	int max_iterations;         // RANSAC iterations per fit
+	double time_budget;         // seconds per fit, 0 for no limit
+
+	SphereFitter()
+	: radius(0), radius_tolerance(0), sample_tolerance(0.05), distance_threshold(0.0070936), min_inlier_ratio(0.6),
+	  min_inliers(10), max_iterations(200), time_budget(0.02), has_last_(false)
+	{}
+
+/**
+	@brief Read the parameters of the fit, the current values are the defaults
+	@param[in] nh private node handle
+	@param[in] prefix prefix of the parameter names, so that each fitter of a node is set on its own
+	@return void
+*/
+	void readParameters(ros::NodeHandle& nh, const std::string& prefix = "sphere")
+	{
+		nh.param(prefix+"Distance", distance_threshold, distance_threshold);
+		nh.param(prefix+"MinInlierRatio", min_inlier_ratio, min_inlier_ratio);
+		nh.param(prefix+"MaxIterations", max_iterations, max_iterations);
+		nh.param(prefix+"TimeBudget", time_budget, time_budget);
+	}
+
+/**
+	@brief Forget the previous sphere
+	@return void
+*/
+	void reset() { has_last_=false; }
+
+	bool hasLast() const { return has_last_; }
+	const Eigen::Vector3f& lastCenter() const { return last_center_; }
+
+/**
+	@brief Fit the ball on a set of points
+	@param[in] cloud point cloud
+	@param[in] indices points of the cloud to use, NULL for all of them
+	@param[out] result fitted sphere and its quality
+	@return bool true if the sphere is the ball
+*/
+	bool fit(const pcl::PointCloud<pcl::PointXYZ>& cloud, const std::vector<int>* indices, SphereFit& result)
+	{
+		ros::WallTime start = ros::WallTime::now();
+		result = SphereFit();
+
+		points_.clear();
+		int n = indices ? indices->size() : cloud.points.size();
+		points_.reserve(n);
+		for(int i=0; i<n; i++)
+		{
+			const pcl::PointXYZ& p = cloud.points[indices ? (*indices)[i] : i];
+			if(pcl_isfinite(p.x) && pcl_isfinite(p.y) && pcl_isfinite(p.z))
+				points_.push_back(p.getVector3fMap());
+		}
+		result.points = points_.size();
+		if(result.points<4)
+			return false;
+
+		Eigen::Vector3f c;
+		float r;
+
+		// 1) the previous sphere, 2) all the points: one least squares each, no sampling
+		if(has_last_ && refine(last_center_, last_radius_, result))
+			result.warm_start = true;
+		else if(leastSquares(all(), c, r) && refine(c, r, result))
+			;
+		else
+			ransac(start, result);
+
+		result.seconds = (ros::WallTime::now()-start).toSec();
+		if(result.valid)
+		{
+			last_center_ = result.center;
+			last_radius_ = result.radius;
+			has_last_ = true;
+		}
+		return result.valid;
+	}
+
+private:
+	const std::vector<int>& all()
+	{
+		if(all_.size()!=points_.size())
+		{
+			all_.resize(points_.size());
+			for(int i=0; i<all_.size(); i++)
+				all_[i]=i;
+		}
+		return all_;
+	}
+
+/**
+	@brief Algebraic least squares sphere
+	@param[in] subset indices in points_ of the points to fit
+	@param[out] c centre
+	@param[out] r radius
+	@return bool false if the points do not define a sphere
+*/
+	bool leastSquares(const std::vector<int>& subset, Eigen::Vector3f& c, float& r) const
+	{
+		if(subset.size()<4)
+			return false;
+
+		// Centred on the mean for conditioning
+		Eigen::Vector3d mean(0,0,0);
+		for(int i=0; i<subset.size(); i++)
+			mean += points_[subset[i]].cast<double>();
+		mean /= subset.size();
+
+		Eigen::Matrix4d A = Eigen::Matrix4d::Zero();
+		Eigen::Vector4d b = Eigen::Vector4d::Zero();
+		for(int i=0; i<subset.size(); i++)
+		{
+			Eigen::Vector3d p = points_[subset[i]].cast<double>()-mean;
+			Eigen::Vector4d row(2*p(0), 2*p(1), 2*p(2), 1);
+			A += row*row.transpose();
+			b += row*p.squaredNorm();
+		}
+
+		Eigen::FullPivLU<Eigen::Matrix4d> lu(A);
+		if(!lu.isInvertible())
+			return false;
+		Eigen::Vector4d s = lu.solve(b);
+
+		double r2 = s(3) + s.head<3>().squaredNorm();
+		if(!(r2>0))
+			return false;
+		c = (s.head<3>()+mean).cast<float>();
+		r = sqrt(r2);
+		return true;
+	}
+
+/**
+	@brief Points closer than the distance threshold to a sphere
+	@param[in] c centre
+	@param[in] r radius
+	@param[out] inliers indices in points_
+	@param[out] sq sum of the squared distances of the inliers
+	@return void
+*/
+	void selectInliers(const Eigen::Vector3f& c, float r, std::vector<int>& inliers, double& sq) const
+	{
+		inliers.clear();
+		sq=0;
+		for(int i=0; i<points_.size(); i++)
+		{
+			double d = fabs((points_[i]-c).norm()-r);
+			if(d<distance_threshold)
+			{
+				inliers.push_back(i);
+				sq+=d*d;
+			}
+		}
+	}
+
+	bool accepted(float r, int inliers) const
+	{
+		return inliers>=min_inliers && inliers>=min_inlier_ratio*points_.size() && fabs(r-radius)<radius_tolerance;
+	}
+
+/**
+	@brief Refit a sphere on its inliers and check it against the ball
+	@param[in] c centre to start from
+	@param[in] r radius to start from
+	@param[in,out] result written when the sphere is accepted
+	@return bool true if the refined sphere is the ball
+*/
+	bool refine(Eigen::Vector3f c, float r, SphereFit& result)
+	{
+		double sq;
+		for(int round=0; round<2; round++)
+		{
+			selectInliers(c, r, inliers_, sq);
+			if(!accepted(r, inliers_.size()) && round==0)
+				return false;
+			if(!leastSquares(inliers_, c, r))
+				return false;
+		}
+		selectInliers(c, r, inliers_, sq);
+		if(!accepted(r, inliers_.size()))
+			return false;
+
+		result.valid = true;
+		result.center = c;
+		result.radius = r;
+		result.inliers = inliers_.size();
+		result.rms = sqrt(sq/inliers_.size());
+		return true;
+	}
+
+/**
+	@brief RANSAC over 4 point samples, bounded in iterations and time
+	@param[in] start time at which the fit started
+	@param[in,out] result fitted sphere and its quality
+	@return void
+*/
+	void ransac(const ros::WallTime& start, SphereFit& result)
+	{
+		boost::random::uniform_int_distribution<int> pick(0, points_.size()-1);
+		std::vector<int> sample(4);
+		Eigen::Vector3f best_c;
+		float best_r=0;
+		int best=0;
+		int needed=max_iterations;
+		double sq;
+
+		for(result.iterations=0; result.iterations<max_iterations && result.iterations<needed; result.iterations++)
+		{
+			if(time_budget>0 && (result.iterations&15)==0 && (ros::WallTime::now()-start).toSec()>time_budget)
+				break;
+
+			// The other three points are drawn within a ball diameter of the first one, so a sample
+			// that starts on the ball usually stays on it even when the ball is a small part of the cloud
+			sample[0]=pick(rng_);
+			int k=1;
+			for(int draw=0; k<4 && draw<64; draw++)
+			{
+				int j=pick(rng_);
+				if((points_[j]-points_[sample[0]]).squaredNorm()<4*radius*radius)
+					sample[k++]=j;
+			}
+			if(k<4)
+				continue;
+
+			Eigen::Vector3f c;
+			float r;
+			if(!leastSquares(sample, c, r) || fabs(r-radius)>sample_tolerance)
+				continue;
+
+			selectInliers(c, r, inliers_, sq);
+			if(inliers_.size()>best)
+			{
+				best=inliers_.size();
+				best_c=c;
+				best_r=r;
+
+				// Samples needed for 99% certainty of one all-inlier sample at the current ratio
+				double w = (double)best/points_.size();
+				double all_in = w*w*w*w;
+				if(all_in>=1)
+					needed=0;
+				else if(all_in>0)
+					needed = std::min((double)max_iterations, log(0.01)/log(1-all_in));
+			}
+		}
+
+		if(best>=4)
+			refine(best_c, best_r, result);
+	}
+
+	bool has_last_;
+	Eigen::Vector3f last_center_;
+	float last_radius_;
+	std::vector<Eigen::Vector3f> points_;
+	std::vector<int> all_;
+	std::vector<int> inliers_;
+	boost::random::mt19937 rng_;
+};
+
+#endif
@@ -50,6 +50,7 @@ public:
     ros::NodeHandle n_;
     ros::Subscriber pointCloud_subscriber;
     sensor_msgs::PointCloud cloud; /**< point cloud from the swissranger. */
+    ros::Time stamp; /**< acquisition time of the cloud, its header is overwritten when it is republished. */
 
 /**
 	@brief Constructor. Subscription of the point cloud from the swissranger
@@ -74,6 +75,7 @@ public:
     void pointCloudUpdate(const sensor_msgs::PointCloud & msg)
     {
         cloud=msg;
+        stamp=msg.header.stamp;
         //ROS_INFO("Scan time: %lf ", msg.data[0]);
     }
 };
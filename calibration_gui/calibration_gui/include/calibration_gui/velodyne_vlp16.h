@@ -61,12 +61,13 @@ using namespace std;
 typedef boost::shared_ptr<Point> PointPtr;
 typedef boost::shared_ptr< ::sensor_msgs::LaserScan> LaserScanPtr;
 
-void getClusters(vector<PointPtr> laserPoints, vector<ClusterPtr> * clusters_nn);
-void velodyne_findBall(vector< vector<PointPtr> > laserscans);
-double find_circle(vector<ClusterPtr> clusters, vector<ClusterPtr>& circleP, int layer);
+void getClusters(const vector<PointPtr> &laserPoints, vector<ClusterPtr> * clusters_nn);
+void velodyne_findBall(const vector< vector<PointPtr> > &laserscans, const ros::Time &stamp);
+double find_circle(vector<ClusterPtr> clusters, vector<ClusterPtr>& circleP, int ring, geometry_msgs::Point& center);
 void calculateSphereCentroid(vector<geometry_msgs::Point> center, geometry_msgs::PointStamped &sphereCentroid, vector<double> radius);
 void rotatePoints(double& x,double& y, double& z, double angle);
-void sphereDetection(pcl::PointCloud<pcl::PointXYZ> Kinect_cloud);
+class SphereFitter;
+void sphereDetection(const pcl::PointCloud<pcl::PointXYZ> &cloud, SphereFitter &fitter, const ros::Time &stamp);
 void getMax(vector<double> vec_in, double max, int max_indx);
 vector<geometry_msgs::Point> removeOut(vector<geometry_msgs::Point> center, vector<double> radius, vector<double> radius_clean);
 double pointsDist(geometry_msgs::Point center1, geometry_msgs::Point center3);
@@ -35,67 +35,8 @@
 #define _LDMRS_VISUALIZATION_RVIZ_H_
 
 #include <vector>
+#include <visualization_msgs/MarkerArray.h>
 
-/**
- * \class Markers
- * Class to handle the visualization markers
- * \author Jorge Almeida in mtt
- *
- */
-
-class Markers
-{
-    public:
-        void update(visualization_msgs::Marker& marker)
-        {
-            for(uint i=0;i<markers.size();++i)
-                if(markers[i].ns==marker.ns && markers[i].id==marker.id)//Marker found
-                {
-                    markers.erase(markers.begin()+i);
-                    break;
-                }
-
-            markers.push_back(marker);
-        }
-
-        void decrement(void)
-        {
-            for(uint i=0;i<markers.size();++i)
-            {
-                switch(markers[i].action)
-                {
-                    case visualization_msgs::Marker::ADD:
-                        markers[i].action = visualization_msgs::Marker::DELETE;
-                        break;
-                    case visualization_msgs::Marker::DELETE:
-                        markers[i].action = -1;
-                        break;
-                }
-            }
-        }
-
-        void clean(void)
-        {
-            vector<visualization_msgs::Marker> new_markers;
-
-            for(uint i=0;i<markers.size();++i)
-                if(markers[i].action!=-1)
-                    new_markers.push_back(markers[i]);
-
-            markers=new_markers;
-        }
-
-        vector<visualization_msgs::Marker> getOutgoingMarkers(void)
-        {
-            vector<visualization_msgs::Marker> m_out(markers);
-            return markers;
-        }
-
-    private:
-
-        vector<visualization_msgs::Marker> markers;
-};
-
-vector<visualization_msgs::Marker> createTargetMarkers(vector<LidarClustersPtr>& sickLidarClusters_nn, vector<LidarClustersPtr>& circlePoints , Point sphere, vector<double> radius);
+const visualization_msgs::MarkerArray& createTargetMarkers(vector<LidarClustersPtr>& sickLidarClusters_nn, vector<LidarClustersPtr>& circlePoints , Point sphere, vector<double> radius);
 
 #endif
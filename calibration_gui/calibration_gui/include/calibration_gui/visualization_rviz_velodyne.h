@@ -36,6 +36,7 @@
 
 #include <vector>
 #include <visualization_msgs/Marker.h>
+#include <visualization_msgs/MarkerArray.h>
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 
@@ -98,7 +99,7 @@ class Markers
         vector<visualization_msgs::Marker> markers;
 };
 
-vector<visualization_msgs::Marker> createTargetMarkers(vector<LidarClustersPtr>& sickLidarClusters_nn, vector<LidarClustersPtr>& circlePoints , Point sphere, vector<double> radius);
+const visualization_msgs::MarkerArray& createTargetMarkers(vector<LidarClustersPtr>& sickLidarClusters_nn, vector<LidarClustersPtr>& circlePoints , Point sphere, vector<double> radius);
 
 vector<visualization_msgs::Marker> createTargetMarkers(pcl::PointXYZ sphereCenter );
 #endif
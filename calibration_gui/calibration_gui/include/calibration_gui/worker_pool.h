@@ -0,0 +1,150 @@
+/**************************************************************************************************
+ Software License Agreement (BSD License)
+
+ Copyright (c) 2014-2015, LAR toolkit developers - University of Aveiro - http://lars.mec.ua.pt
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without modification, are permitted
+ provided that the following conditions are met:
+
+  *Redistributions of source code must retain the above copyright notice, this list of
+   conditions and the following disclaimer.
+  *Redistributions in binary form must reproduce the above copyright notice, this list of
+   conditions and the following disclaimer in the documentation and/or other materials provided
+   with the distribution.
+  *Neither the name of the University of Aveiro nor the names of its contributors may be used to
+   endorse or promote products derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+***************************************************************************************************/
+/**
+\file  worker_pool.h
+\brief Fixed pool of worker threads used to process the layers of the multi-layer lasers concurrently
+*/
+
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+
+/**
+  \class WorkerPool
+  \brief Runs the indices [0, n) of a job on a fixed set of threads and waits for all of them
+
+  The threads are created once and sleep between calls, so run() only pays for a wake up. The
+  calling thread takes indices as well, which means a pool with zero threads runs the job serially.
+ */
+class WorkerPool
+{
+public:
+/**
+	@brief Constructor. Starts the worker threads
+	@param[in] threads number of extra threads, 0 runs every job on the calling thread
+*/
+	explicit WorkerPool(int threads=0)
+	: count_(0), next_(0), remaining_(0), stop_(false)
+	{
+		for(int i=0; i<threads; i++)
+			threads_.create_thread(boost::bind(&WorkerPool::worker, this));
+	}
+
+	~WorkerPool()
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			stop_=true;
+		}
+		work_cv_.notify_all();
+		threads_.join_all();
+	}
+
+/**
+	@brief Number of worker threads, not counting the caller
+	@return int
+*/
+	int size() const { return threads_.size(); }
+
+/**
+	@brief Call job(i) for every i in [0, n) and return once all calls have finished
+	@param[in] n number of indices
+	@param[in] job function to call, must be safe to run concurrently for different indices
+	@return void
+*/
+	void run(int n, const boost::function<void (int)>& job)
+	{
+		if(n<=0)
+			return;
+
+		if(threads_.size()==0)
+		{
+			for(int i=0; i<n; i++)
+				job(i);
+			return;
+		}
+
+		boost::unique_lock<boost::mutex> lock(mutex_);
+		job_=job;
+		count_=n;
+		next_=0;
+		remaining_=n;
+		work_cv_.notify_all();
+
+		while(next_<count_)
+		{
+			int i=next_++;
+			lock.unlock();
+			job(i);
+			lock.lock();
+			remaining_--;
+		}
+
+		while(remaining_>0)
+			done_cv_.wait(lock);
+
+		job_.clear();
+	}
+
+private:
+	void worker()
+	{
+		boost::unique_lock<boost::mutex> lock(mutex_);
+		while(true)
+		{
+			while(!stop_ && next_>=count_)
+				work_cv_.wait(lock);
+			if(stop_)
+				return;
+
+			int i=next_++;
+			boost::function<void (int)> job=job_;
+			lock.unlock();
+			job(i);
+			lock.lock();
+			if(--remaining_==0)
+				done_cv_.notify_all();
+		}
+	}
+
+	boost::thread_group threads_;
+	boost::mutex mutex_;
+	boost::condition_variable work_cv_;
+	boost::condition_variable done_cv_;
+	boost::function<void (int)> job_;
+	int count_;
+	int next_;
+	int remaining_;
+	bool stop_;
+};
+typedef boost::shared_ptr<WorkerPool> WorkerPoolPtr;
+
+#endif
@@ -31,8 +31,11 @@
  \date   December, 2015
 */
 
+#define _COMMON_FUNCTIONS_CPP_
+
 #include <lidar_segmentation/lidar_segmentation.h>
 #include "calibration_gui/sick_ldmrs.h"
+#include "calibration_gui/common_functions.h"
 #include <lidar_segmentation/clustering.h>
 #include <lidar_segmentation/groundtruth.h>
 #include <cmath>
@@ -42,6 +45,7 @@
 #include <complex>
 #include <geometry_msgs/PointStamped.h>
 #include <geometry_msgs/Point.h>
+#include <boost/unordered_map.hpp>
 
 
 /**
@@ -53,7 +57,7 @@
 */
 void CalculateCircle(ClusterPtr cluster, double& R, Point& Center)
 {
-    double Sx=0,Sy=0,x_m,y_m,u,v,Suu,Svv,Suv,Suuu,Svvv,Suvv,Svuu,uc,vc;
+    double Sx=0,Sy=0,x_m,y_m,u,v,Suu=0,Svv=0,Suv=0,Suuu=0,Svvv=0,Suvv=0,Svuu=0,uc,vc;
     for(int i=0;i<cluster->support_points.size();i++)
     {
         Sx+=cluster->support_points[i]->x;
@@ -83,12 +87,120 @@ void CalculateCircle(ClusterPtr cluster, double& R, Point& Center)
     Center.x=uc;
     Center.y=vc;
 
+    R=0;
     for(int i=0;i<cluster->support_points.size();i++)
         R+=sqrt(pow((cluster->support_points[i]->x-uc),2) + pow((cluster->support_points[i]->y-vc),2));
 
     R=R/cluster->support_points.size();
 }
 
+/**
+@brief Rotation of a point around the Y axis, the same as rotatePoints of the laser nodes
+@param[in,out] x x coordinate
+@param[in,out] y y coordinate
+@param[in,out] z z coordinate
+@param[in] angle angle to rotate, in degrees
+@return void
+*/
+static void tiltPoint(double& x, double& y, double& z, double angle)
+{
+    double c=cos(angle*M_PI/180), s=sin(angle*M_PI/180);
+    double X=x,Z=z;
+    x=X*c + Z*s;
+    z=-X*s + Z*c;
+}
+
+/**
+@brief Mean and standard deviation of the angle under which the inner points see the chord between the first and the last point
+@param[in] cluster cluster to test
+@param[out] mean mean inscribed angle, in degrees
+@param[out] deviation standard deviation of the inscribed angle, in degrees
+@return bool false if the cluster is too short or too large to be a section of the ball
+*/
+bool CircleDetector::angleStatistics(ClusterPtr cluster, double& mean, double& deviation) const
+{
+    const vector<PointPtr>& points = cluster->support_points;
+    int last = points.size()-1;
+    if(last<min_span)
+        return false;
+
+    // A section of the ball never spans more than its diameter in any direction
+    if(max_extent>0)
+    {
+        double min_x=points[0]->x, max_x=min_x, min_y=points[0]->y, max_y=min_y, min_z=points[0]->z, max_z=min_z;
+        for(int j=1; j<=last; j++)
+        {
+            min_x=std::min(min_x,points[j]->x); max_x=std::max(max_x,points[j]->x);
+            min_y=std::min(min_y,points[j]->y); max_y=std::max(max_y,points[j]->y);
+            min_z=std::min(min_z,points[j]->z); max_z=std::max(max_z,points[j]->z);
+        }
+        if(max_x-min_x>max_extent || max_y-min_y>max_extent || max_z-min_z>max_extent)
+            return false;
+    }
+
+    const Point& first = *points[0];
+    const Point& end = *points[last];
+
+    // Welford's running mean and variance, no storage for the angles
+    int n=0;
+    double m=0, m2=0;
+    for(int j=1; j<last-1; j++)
+    {
+        const Point& p = *points[j];
+        double ax=first.x-p.x, ay=first.y-p.y, az=first.z-p.z;
+        double bx=end.x-p.x, by=end.y-p.y, bz=end.z-p.z;
+        double angle = acos((ax*bx + ay*by + az*bz) / sqrt((ax*ax + ay*ay + az*az)*(bx*bx + by*by + bz*bz)));
+
+        n++;
+        double delta = angle-m;
+        m += delta/n;
+        m2 += delta*(angle-m);
+    }
+
+    mean = m/M_PI*180;
+    deviation = sqrt(m2/(n-1))/M_PI*180;
+    return true;
+}
+
+/**
+@brief Inscribed angle test followed by the circle fit
+@param[in] cluster cluster to test
+@param[in] tilt rotation of the scan plane in relation to the XY plane, in degrees, the fit is done on a rotated copy
+@param[out] R radius of the circle
+@param[out] center coordinates of the circle center, rotated back to the scan plane
+@return bool true if the cluster is a section of the ball
+*/
+bool CircleDetector::detect(ClusterPtr cluster, double tilt, double& R, Point& center) const
+{
+    double m, deviation;
+    if(!angleStatistics(cluster,m,deviation))
+        return false;
+
+    if(!(m>min_angle && m<max_angle && deviation<max_std))
+        return false;
+
+    if(tilt==0)
+    {
+        CalculateCircle(cluster,R,center);
+        return true;
+    }
+
+    ClusterPtr flat (new Cluster);
+    flat->support_points.reserve(cluster->support_points.size());
+    for(int i=0; i<cluster->support_points.size(); i++)
+    {
+        PointPtr p (new Point(*cluster->support_points[i]));
+        tiltPoint(p->x,p->y,p->z,tilt);
+        flat->support_points.push_back(p);
+    }
+    CalculateCircle(flat,R,center);
+
+    double z=0;
+    tiltPoint(center.x,center.y,z,-tilt);
+    center.z=z;
+    return true;
+}
+
 /**
 @brief Creation of several points that belong to a circle based on its properties
 @param[out] circle_points points created
@@ -112,6 +224,199 @@ void circlePoints(vector<ClusterPtr>& circle_points, double radius, double centr
     circle_points.push_back(cPoints);
 }
 
+/**
+@brief Create a cluster with the points [begin, end) of a list
+@param[in] points list of points
+@param[in] indices order in which the points are taken, or NULL for the list order
+@param[in] begin first position
+@param[in] end one past the last position
+@param[in] id id of the new cluster
+@return ClusterPtr
+*/
+static ClusterPtr makeCluster(const vector<PointPtr>& points, const vector<int>* indices, int begin, int end, int id)
+{
+    ClusterPtr cluster (new Cluster);
+    cluster->id=id;
+    cluster->support_points.reserve(end-begin);
+
+    PointPtr centroid (new Point);
+    for(int i=begin; i<end; i++)
+    {
+        const PointPtr& p = points[indices ? (*indices)[i] : i];
+        cluster->support_points.push_back(p);
+        centroid->x+=p->x;
+        centroid->y+=p->y;
+        centroid->z+=p->z;
+    }
+    centroid->x/=(end-begin);
+    centroid->y/=(end-begin);
+    centroid->z/=(end-begin);
+    cluster->centroid=centroid;
+    return cluster;
+}
+
+/**
+@brief Nearest neighbour clustering of a scan whose points are in acquisition order
+@details Consecutive points further apart than the threshold start a new cluster, so a scan is
+clustered in a single pass. The last cluster is joined with the first one when the scan closes on
+itself. Points that are not ordered by bearing are handed to gridClustering.
+@param[in] points laser points, in the order of the scan
+@param[in] threshold maximum distance between neighbours of the same cluster
+@param[out] clusters resulting clusters
+@return void
+*/
+void scanClustering(const vector<PointPtr>& points, double threshold, vector<ClusterPtr>& clusters)
+{
+    clusters.clear();
+    int n=points.size();
+    if(n==0)
+        return;
+
+    // The bearing of a scan turns the same way from point to point and wraps around at most once
+    int forward=0, backward=0;
+    for(int i=1; i<n; i++)
+    {
+        double cross = points[i-1]->x*points[i]->y - points[i-1]->y*points[i]->x;
+        if(cross>0)
+            forward++;
+        else if(cross<0)
+            backward++;
+    }
+    if(min(forward,backward)>max(1,n/50))
+    {
+        gridClustering(points,threshold,clusters);
+        return;
+    }
+
+    double threshold2 = threshold*threshold;
+    vector<int> breaks;
+    breaks.push_back(0);
+    for(int i=1; i<n; i++)
+    {
+        double dx = points[i]->x-points[i-1]->x;
+        double dy = points[i]->y-points[i-1]->y;
+        if(dx*dx+dy*dy>threshold2)
+            breaks.push_back(i);
+    }
+
+    // Full revolution: the points before the first break continue the last cluster
+    int first_end = breaks.size()>1 ? breaks[1] : n;
+    double dx = points[0]->x-points[n-1]->x;
+    double dy = points[0]->y-points[n-1]->y;
+    bool closed = breaks.size()>1 && dx*dx+dy*dy<=threshold2;
+
+    clusters.reserve(breaks.size());
+    for(int b=closed ? 1 : 0; b<breaks.size(); b++)
+    {
+        int begin = breaks[b];
+        int end = b+1<breaks.size() ? breaks[b+1] : n;
+        if(closed && end==n)
+        {
+            vector<int> wrap;
+            wrap.reserve(n-begin+first_end);
+            for(int i=begin; i<n; i++)
+                wrap.push_back(i);
+            for(int i=0; i<first_end; i++)
+                wrap.push_back(i);
+            clusters.push_back(makeCluster(points,&wrap,0,wrap.size(),clusters.size()));
+        }
+        else
+            clusters.push_back(makeCluster(points,NULL,begin,end,clusters.size()));
+    }
+}
+
+/**
+@brief Nearest neighbour clustering of unordered points
+@details The points are hashed into a 2D grid with cells the size of the threshold, so only the
+3x3 neighbouring cells are searched for each point. Clusters keep the relative order of their points.
+@param[in] points laser points
+@param[in] threshold maximum distance between neighbours of the same cluster
+@param[out] clusters resulting clusters
+@return void
+*/
+void gridClustering(const vector<PointPtr>& points, double threshold, vector<ClusterPtr>& clusters)
+{
+    clusters.clear();
+    int n=points.size();
+    if(n==0)
+        return;
+
+    typedef boost::unordered_map<long long, vector<int> > Grid;
+    Grid grid;
+    grid.reserve(n);
+    vector<long long> cx(n), cy(n);
+    for(int i=0; i<n; i++)
+    {
+        cx[i] = (long long)floor(points[i]->x/threshold);
+        cy[i] = (long long)floor(points[i]->y/threshold);
+        grid[(cx[i]<<32) ^ (cy[i] & 0xffffffffLL)].push_back(i);
+    }
+
+    // Union-find over the points, with path halving
+    vector<int> parent(n);
+    for(int i=0; i<n; i++)
+        parent[i]=i;
+
+    double threshold2 = threshold*threshold;
+    for(int i=0; i<n; i++)
+    {
+        for(long long gx=cx[i]-1; gx<=cx[i]+1; gx++)
+            for(long long gy=cy[i]-1; gy<=cy[i]+1; gy++)
+            {
+                Grid::const_iterator cell = grid.find((gx<<32) ^ (gy & 0xffffffffLL));
+                if(cell==grid.end())
+                    continue;
+                for(int c=0; c<cell->second.size(); c++)
+                {
+                    int j = cell->second[c];
+                    if(j<=i)
+                        continue;
+                    double dx = points[i]->x-points[j]->x;
+                    double dy = points[i]->y-points[j]->y;
+                    if(dx*dx+dy*dy>threshold2)
+                        continue;
+
+                    int a=i, b=j;
+                    while(parent[a]!=a)
+                        a = parent[a] = parent[parent[a]];
+                    while(parent[b]!=b)
+                        b = parent[b] = parent[parent[b]];
+                    if(a!=b)
+                        parent[max(a,b)]=min(a,b);
+                }
+            }
+    }
+
+    // Group the points by root, clusters are numbered by their first point
+    vector<int> label(n,-1);
+    vector<int> count;
+    for(int i=0; i<n; i++)
+    {
+        int r=i;
+        while(parent[r]!=r)
+            r=parent[r];
+        if(label[r]<0)
+        {
+            label[r]=count.size();
+            count.push_back(0);
+        }
+        label[i]=label[r];
+        count[label[i]]++;
+    }
+
+    vector<int> offset(count.size()+1,0);
+    for(int k=0; k<count.size(); k++)
+        offset[k+1]=offset[k]+count[k];
+    vector<int> order(n);
+    vector<int> fill(offset.begin(),offset.end()-1);
+    for(int i=0; i<n; i++)
+        order[fill[label[i]]++]=i;
+
+    clusters.reserve(count.size());
+    for(int k=0; k<count.size(); k++)
+        clusters.push_back(makeCluster(points,&order,offset[k],offset[k+1],k));
+}
+
 /**
 @brief Convert data to XYZ
 @param[in] scan laser scan
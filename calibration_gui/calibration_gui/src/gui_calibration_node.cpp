@@ -42,11 +42,14 @@
 #include "calibration_gui/gui_mainwindow.h"
 #include "ui_mainwindow.h"
 #include "calibration_gui/calibration.h"
+#include "calibration_gui/correspondence_log.h"
+#include "calibration_gui/online_rigid_transform.h"
 #include "calibration_gui/visualization_rviz_calibration.h"
 
 // Generic includes
 #include <string>
 #include <std_msgs/String.h>
+#include <std_msgs/Float64MultiArray.h>
 #include <sstream>
 #include <QDebug>
 
@@ -125,6 +128,34 @@ bool QNode::on_init(const std::string &master_url, const std::string &host_url)
 	return true;
 }
 
+/**
+   @brief Saves the ball centers acquired so far to a PCD file per sensor, plus one for the PnP centers of every camera
+   @param[in] nodes names of the sensors
+   @param[in] camera true for the sensors that are cameras
+   @param[in] sensorClouds ball centers of every sensor
+   @param[in] cameraCloudsPnP ball centers on the image of every camera
+   @return void
+ */
+static void savePCDFiles(const vector<string>& nodes, const vector<bool>& camera,
+                         const vector<pcl::PointCloud<pcl::PointXYZ> >& sensorClouds,
+                         const vector<pcl::PointCloud<pcl::PointXYZ> >& cameraCloudsPnP)
+{
+	// Every sensor has the same number of points, nothing was acquired if the first has none
+	if (sensorClouds.empty() || sensorClouds.front().empty())
+		return;
+
+	int cameraCounter = 0;
+	for ( int i = 0; i < sensorClouds.size(); i++ )
+	{
+		pcl::io::savePCDFileASCII(file_path + nodes[i] + ".pcd", sensorClouds[i]);
+		if (camera[i])
+		{
+			pcl::io::savePCDFileASCII(file_path + nodes[i] + "_PnP.pcd", cameraCloudsPnP[cameraCounter]);
+			cameraCounter++;
+		}
+	}
+}
+
 /**
    @brief Function called after the thread is started. It executes the calibration process; acquiring data from the chosen sensors and then computing their extrinsic transformations relative to a reference sensor.
    @param void
@@ -139,11 +170,19 @@ void QNode::run() {
 	markers_pub = n.advertise<visualization_msgs::MarkerArray>( node_name + "/CalibrationPoints", 10000);
 	//car_pub = n.advertise<visualization_msgs::Marker>(node_name + "/3DModel", 1);
 
-	CircleCentroids centroids(calibrationNodes, isCamera);
+	// Detections of the different sensors are paired when their time stamps differ less than syncTolerance
+	double sync_tolerance;
+	int sync_history, sync_image_history;
+	ros::NodeHandle pn("~");
+	pn.param("syncTolerance", sync_tolerance, 0.05);
+	pn.param("syncHistory", sync_history, 20);
+	pn.param("syncImageHistory", sync_image_history, 8);
+
+	CircleCentroids centroids(calibrationNodes, isCamera, sync_history, sync_image_history);
 
-	vector<pcl::PointXYZ> sensorsBallCenters;
-	vector<pcl::PointXYZ> camCentroidPnP;
-	vector<cv::Mat> camImage;
+	vector<pcl::PointXYZ> sensorsBallCenters = centroids.getSensorsBallCenters();
+	vector<pcl::PointXYZ> camCentroidPnP = centroids.getCamCentroidPnP();
+	vector<cv::Mat> camImage = centroids.getCamImage();
 
 	// Vector for containing future pointclouds for each sensor
 	vector<pcl::PointCloud<pcl::PointXYZ> > sensorClouds;
@@ -185,6 +224,29 @@ void QNode::run() {
 
 	createDirectory( );
 
+	// Accepted points are appended to a binary log and the images encoded on a background thread.
+	// The PCD files are written at the end, or every pcdExportEvery points when it is set
+	int pcd_export_every;
+	pn.param("pcdExportEvery", pcd_export_every, 0);
+	CorrespondenceLog correspondences;
+	correspondences.open(file_path + "correspondences.bin", calibrationNodes, cameraCloudsPnP.size());
+
+	// Transformation of every sensor to the reference one, refreshed with each acquired point. The
+	// acquisition stops once no residual changes more than convergenceTolerance (meters) for
+	// convergencePoints points in a row
+	bool auto_stop;
+	int min_points, convergence_points;
+	double convergence_tolerance;
+	pn.param("autoStop", auto_stop, true);
+	pn.param("minPoints", min_points, 10);
+	pn.param("convergencePoints", convergence_points, 5);
+	pn.param("convergenceTolerance", convergence_tolerance, 0.001);
+	vector<OnlineRigidTransform> onlineTransforms(calibrationNodes.size());
+	vector<double> lastResiduals(calibrationNodes.size(), -1);
+	int stablePoints = 0;
+	bool converged = false;
+	ros::Publisher residual_pub = n.advertise<std_msgs::Float64MultiArray>( node_name + "/CalibrationResidual", 10);
+
 	qDebug() << "Calibration is going to start";
 
 	float diff_displacement;
@@ -194,35 +256,9 @@ void QNode::run() {
 
 	ros::Rate loop_rate(50);
 
-	while(count < num_of_points && ros::ok() && doCalibration)
+	while(count < num_of_points && ros::ok() && doCalibration && !converged)
 	{
-		sensorsBallCenters = centroids.getSensorsBallCenters();
-		camCentroidPnP = centroids.getCamCentroidPnP();
-		camImage = centroids.getCamImage();
-
-		// qDebug() << sensorsBallCenters.size();
-
-		int finder = 0;
-		bool found = false;
-		while ( finder < sensorsBallCenters.size() )
-		{
-			if (sensorsBallCenters[finder].x == -999)
-			{
-				found = true;
-				break;
-			}
-			finder++;
-		}
-		finder=0;
-		while ( finder < camCentroidPnP.size() && !found )
-		{
-			if (camCentroidPnP[finder].x == -999)
-			{
-				found = true;
-				break;
-			}
-			finder++;
-		}
+		bool found = !centroids.getMatchedCentroids(sync_tolerance, sensorsBallCenters, camCentroidPnP, camImage);
 
 		if(!found)
 		{
@@ -275,7 +311,7 @@ void QNode::run() {
 						cameraCloudsPnP[cameraCounter].push_back(camCentroidPnP[cameraCounter]);
 						string imgPath = file_path + "img_" + calibrationNodes[i] +"_" + boost::lexical_cast<std::string>(count) + ".jpg";
 						cout << imgPath << "\n" << camImage.size() << endl;
-						imwrite( imgPath, camImage[cameraCounter] );
+						correspondences.saveImage( imgPath, camImage[cameraCounter] );
 
 						cameraCounter++;
 						qDebug() << cameraCounter;
@@ -283,19 +319,36 @@ void QNode::run() {
 				}
 
 
-				// Saving all point clouds to a PCD file
-				cameraCounter = 0;
-				for ( int i = 0; i < sensorClouds.size(); i++ )
+				correspondences.append( count, centroids.getMatchTime(), sensorsBallCenters, camCentroidPnP );
+				if (pcd_export_every > 0 && (count+1) % pcd_export_every == 0)
+					savePCDFiles(calibrationNodes, isCamera, sensorClouds, cameraCloudsPnP);
+
+				// Live estimate of every sensor pose, the reference sensor keeps the identity
+				std_msgs::Float64MultiArray residuals;
+				residuals.data.assign(sensorsBallCenters.size(), 0);
+				bool stable = count+1 >= min_points;
+				for (int i = 1; i < sensorsBallCenters.size(); i++)
 				{
-					pcl::io::savePCDFileASCII(file_path + calibrationNodes[i] + ".pcd", sensorClouds[i]);
-					if (isCamera[i])
+					onlineTransforms[i].add(sensorsBallCenters[i], sensorsBallCenters.front());
+					if (!onlineTransforms[i].valid())
 					{
-						pcl::io::savePCDFileASCII(file_path + calibrationNodes[i] + "_PnP.pcd", cameraCloudsPnP[cameraCounter]);
-						cameraCounter++;
+						stable = false;
+						continue;
 					}
+					onlineTransforms[i].pose(sensorPoses[i]);
+					residuals.data[i] = onlineTransforms[i].residual();
+					if (lastResiduals[i] < 0 || fabs(residuals.data[i] - lastResiduals[i]) > convergence_tolerance)
+						stable = false;
+					lastResiduals[i] = residuals.data[i];
+					cout << "residual " << calibrationNodes.front() << "_" << calibrationNodes[i] << " = " << residuals.data[i] << endl;
+				}
+				residual_pub.publish(residuals);
+				stablePoints = stable ? stablePoints+1 : 0;
+				if (auto_stop && sensorsBallCenters.size() > 1 && stablePoints >= convergence_points)
+				{
+					converged = true;
+					cout << "Residuals converged after " << count+1 << " points" << endl;
 				}
-
-				qDebug() << "pcd save";
 
 				// PointClouds and Poses visualization for Rviz (vector concatenation can probably be improved)
 				visualizationPoses.clear();
@@ -313,7 +366,7 @@ void QNode::run() {
 				markers_pub.publish(targets_markers);
 
 				count++;
-				if (count < num_of_points && !acquisitionIsAuto) // If acquisitionIsAuto is false then the user is prompted before acquiring points.
+				if (count < num_of_points && !converged && !acquisitionIsAuto) // If acquisitionIsAuto is false then the user is prompted before acquiring points.
 				{
 					QMessageBox::StandardButton reply;
 
@@ -329,6 +382,10 @@ void QNode::run() {
 		loop_rate.sleep();
 	}
 
+	correspondences.close();
+	savePCDFiles(calibrationNodes, isCamera, sensorClouds, cameraCloudsPnP);
+	qDebug() << "pcd save";
+
 	if (doCalibration)
 	{
 
@@ -34,6 +34,7 @@
 
  #include "calibration_gui/kinect.h"
  #include "calibration_gui/visualization_rviz_kinect.h"
+ #include "calibration_gui/organized_sphere_search.h"
 
 // TF
  #include <tf/transform_broadcaster.h>
@@ -41,6 +42,8 @@
 
 ros::Publisher markers_pub;
 ros::Publisher sphereCenter_pub;
+OrganizedSphereSearch organized_search;
+SphereFitter cloud_fitter;
 
 
 /**
@@ -58,9 +61,10 @@ void writeFile(Eigen::VectorXf sphereCoeffsRefined)
 /**
    @brief Detection of the ball on the Kinect data
    @param[in] Kinect_cloud point cloud from the Kinect
+   @param[in] stamp acquisition time of the data, copied into the published centroid
    @return void
  */
-void sphereDetection(pcl::PointCloud<pcl::PointXYZ> Kinect_cloud)
+void sphereDetection(const pcl::PointCloud<pcl::PointXYZ>& Kinect_cloud, const ros::Time& stamp)
 {
 
 	ros::Time start = ros::Time::now();
@@ -201,65 +205,75 @@ void sphereDetection(pcl::PointCloud<pcl::PointXYZ> Kinect_cloud)
 
 	   }*/
 
-	/* METHOD #3 ================================================================
-	 * Detects the ball up to 3 meters, fast. Optimized Method #1
+	/* METHOD #4 ================================================================
+	 * The organized cloud is a depth image: spheres are fitted only on the blobs
+	 * of the ball size, starting with the one closest to the last detection
 	 */
-	pcl::PointCloud<pcl::PointXYZ>::Ptr Kinect_cloudPtr (new pcl::PointCloud<pcl::PointXYZ>(Kinect_cloud));
+	bool found = false;
+	if(organized_search.enabled && Kinect_cloud.height>1)
+	{
+		SphereFit sphere;
+		found = organized_search.detect(Kinect_cloud, sphere);
 
-	pcl::PointCloud<pcl::PointXYZ>::Ptr Kinect_cloud_filtered (new pcl::PointCloud<pcl::PointXYZ>);
+		ros::Time end = ros::Time::now();
 
-	pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_p (new pcl::PointCloud<pcl::PointXYZ>);
+		cout << "Ball detection time organized: " <<  (end - start).toNSec() * 1e-6 << " msec"  << endl;
 
-	//std::cerr << "PointCloud before filtering: " << Kinect_cloudPtr->width * Kinect_cloudPtr->height << " data points." << std::endl;
+		if(found)
+		{
+			sphereCenter.point.x = sphere.center(0);
+			sphereCenter.point.y = sphere.center(1);
+			sphereCenter.point.z = sphere.center(2);
 
-	pcl::VoxelGrid<pcl::PointXYZ> sor;
-	sor.setInputCloud (Kinect_cloudPtr);
-	sor.setFilterFieldName ("z");
-	sor.setFilterLimits (0, 5);
-	sor.setLeafSize (0.005f, 0.005f, 0.005f);
-	sor.filter (*Kinect_cloud_filtered);
+			cout << "Accepted: " << sphere << endl;
+		}
+	}
 
-	//std::cerr << "PointCloud after filtering: " << Kinect_cloud_filtered->width * Kinect_cloud_filtered->height << " data points." << std::endl;
+	// No blob of the ball size (e.g. a hand-held ball, joined in depth to the arm)
+	// or no sphere on them: fit on the whole cloud as when the search is off
+	if(!found)
+	{
+		/* METHOD #3 ================================================================
+		 * Detects the ball up to 3 meters, fast. Optimized Method #1
+		 */
+		pcl::PointCloud<pcl::PointXYZ>::Ptr Kinect_cloudPtr (new pcl::PointCloud<pcl::PointXYZ>(Kinect_cloud));
 
-	pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients ());
-	pcl::PointIndices::Ptr inliers (new pcl::PointIndices ());
+		pcl::PointCloud<pcl::PointXYZ>::Ptr Kinect_cloud_filtered (new pcl::PointCloud<pcl::PointXYZ>);
 
-	// Create the segmentation object
-	pcl::SACSegmentation<pcl::PointXYZ> seg;
-	// Optional
-	seg.setOptimizeCoefficients (true);
-	// Mandatory
-	seg.setModelType (pcl::SACMODEL_SPHERE);
-	seg.setMethodType (pcl::SAC_RANSAC);
-	seg.setMaxIterations (10000);
-	seg.setDistanceThreshold (0.0070936);
-	seg.setProbability(0.99);
-	seg.setRadiusLimits (BALL_DIAMETER/2-0.05, BALL_DIAMETER/2+0.05);
-	seg.setInputCloud (Kinect_cloud_filtered);
-	seg.segment (*inliers, *coefficients);
+		pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_p (new pcl::PointCloud<pcl::PointXYZ>);
 
-	ros::Time end = ros::Time::now();
+		//std::cerr << "PointCloud before filtering: " << Kinect_cloudPtr->width * Kinect_cloudPtr->height << " data points." << std::endl;
 
-	cout << "Ball detection time filtered: " <<  (end - start).toNSec() * 1e-6 << " msec"  << endl;
+		pcl::VoxelGrid<pcl::PointXYZ> sor;
+		sor.setInputCloud (Kinect_cloudPtr);
+		sor.setFilterFieldName ("z");
+		sor.setFilterLimits (0, 5);
+		sor.setLeafSize (0.005f, 0.005f, 0.005f);
+		sor.filter (*Kinect_cloud_filtered);
 
-	cout << *coefficients << endl;
+		//std::cerr << "PointCloud after filtering: " << Kinect_cloud_filtered->width * Kinect_cloud_filtered->height << " data points." << std::endl;
 
-	if(inliers->indices.size ()>0)
-	{
+		SphereFit sphere;
+		found = cloud_fitter.fit(*Kinect_cloud_filtered, NULL, sphere);
 
-		if (coefficients->values[3]<BALL_DIAMETER/2 + 0.05*BALL_DIAMETER/2 && coefficients->values[3]>BALL_DIAMETER/2 - 0.05*BALL_DIAMETER/2)
-		{
-			sphereCenter.point.x = coefficients->values[0];
-			sphereCenter.point.y = coefficients->values[1];
-			sphereCenter.point.z = coefficients->values[2];
+		ros::Time end = ros::Time::now();
+
+		cout << "Ball detection time filtered: " <<  (end - start).toNSec() * 1e-6 << " msec"  << endl;
+
+		cout << sphere << endl;
 
+		if(found)
+		{
+			sphereCenter.point.x = sphere.center(0);
+			sphereCenter.point.y = sphere.center(1);
+			sphereCenter.point.z = sphere.center(2);
 
-			cout << "Accepted: " << *coefficients << endl;
+			cout << "Accepted: " << sphere << endl;
 		}
 	}
   // Ball detection ends here ==================================================
 
-	sphereCenter.header.stamp = ros::Time::now();
+	sphereCenter.header.stamp = stamp;
 	sphereCenter_pub.publish(sphereCenter);
 
 	pcl::PointXYZ center;
@@ -290,6 +304,19 @@ int main(int argc, char **argv)
 	cout << "Node namespace:" << node_ns << endl;
 	cout << "Ball diameter:" << BALL_DIAMETER << endl;
 
+	organized_search.ball_diameter = BALL_DIAMETER;
+	organized_search.step = 2;
+	organized_search.readParameters(n);
+	cout << "Organized search:" << organized_search.enabled << endl;
+
+	// Whole cloud fit, used when the cloud is not organized or the organized search fails: the ball is a small part of the cloud
+	cloud_fitter.radius = BALL_DIAMETER/2;
+	cloud_fitter.radius_tolerance = 0.05*BALL_DIAMETER/2;
+	cloud_fitter.max_iterations = 10000;
+	cloud_fitter.time_budget = 0.1;
+	cloud_fitter.min_inlier_ratio = 0;
+	cloud_fitter.readParameters(n, "cloudSphere");
+
 	markers_pub = n.advertise<visualization_msgs::MarkerArray>( "BallDetection", 1000);
 	sphereCenter_pub = n.advertise<geometry_msgs::PointStamped>("SphereCentroid",1000);
 
@@ -308,7 +335,7 @@ int main(int argc, char **argv)
 
 		if(cloud.cloud.points.size())
 		{
-			sphereDetection(cloud.cloud);
+			sphereDetection(cloud.cloud, pcl_conversions::fromPCL(cloud.cloud.header).stamp);
 		}
 		ros::spinOnce();
 		loop_rate.sleep();
@@ -2,6 +2,8 @@
 #include <iostream>
 #include <string>
 #include "calibration_gui/point_grey_camera.h"
+#include "ball_segmentation/background_model.h"
+#include "ball_segmentation/hsv_segmentation.h"
 
 // Marker's publisher
 ros::Publisher ballCentroidCam_pub;
@@ -23,97 +25,16 @@ int maxR;
 int minR;
 
 bool firstframe;
-cv::Mat bg;
+BackgroundModel background;
 cv::Mat click;
 uchar hue = 2;
+HueSegmenter segmenter;
+MaskSupport support(2);
+cv::Mat mask;
+// ball pixels (with full 5x5 support) needed to publish the ball centre
+int minBallPixels;
 
-int getH(int r, int g, int b)
-{
-  int max, min, delta;
-
-  if (r >= g && r >= b)
-  {
-    max = r;
-  }
-
-  if (g >= r && g >= b)
-  {
-    max = g;
-  }
-
-  if (b >= r && b >= g)
-  {
-    max = b;
-  }
-
-  if (r <= g && r <= b)
-  {
-    min = r;
-  }
-
-  if (g <= r && g <= b)
-  {
-    min = g;
-  }
-
-  if (b <= r && b <= g)
-  {
-    min = b;
-  }
-
-  delta = max - min;
-
-  if (delta == 0)
-  {
-    return 0;
-  }
-
-  int result;
-
-  if (max == r)
-  {
-    result = (int)((60 / 1.41) * (fmod(((g - b) / (float)delta), 6))) % 256;
-  }
-
-  if (max == g)
-  {
-    result = (int)((60 / 1.41) * (((b - r) / (float)delta + 2))) % 256;
-  }
-
-  if (max == b)
-  {
-    result = (int)((60 / 1.41) * (((r - g) / (float)delta + 4))) % 256;
-  }
-
-  if (result < 0)
-  {
-    return 256 - result;
-  }
-  else
-    return result;
-}
-
-int getV(int r, int g, int b)
-{
-  int max, min, delta;
-
-  if (r >= g && r >= b)
-  {
-    return r;
-  }
-
-  if (g >= r && g >= b)
-  {
-    return g;
-  }
-
-  else
-  {  // if(b >= r && b >= g) {
-    return b;
-  }
-}
-
-void PublishBallCenter(Mat &img, Mat &imgBinary, int centerX, int centerY, int boundX, int boundY)
+void PublishBallCenter(Mat &img, Mat &imgBinary, int centerX, int centerY, int boundX, int boundY, const ros::Time &stamp)
 {
   vector<vector<Point> > contours;
   Mat imgCanny;
@@ -168,7 +89,7 @@ void PublishBallCenter(Mat &img, Mat &imgBinary, int centerX, int centerY, int b
   centroidRadius.y = camera_vector.at<double>(1);
   centroidRadius.z = camera_vector.at<double>(2);
 
-  CentroidPub(centroid, centroidRadius);
+  CentroidPub(centroid, centroidRadius, stamp);
 }
 
 void mouseHandler(int event, int x, int y, int flags, void *param)
@@ -192,9 +113,10 @@ void mouseHandler(int event, int x, int y, int flags, void *param)
 /**
    @brief Image processing and ball detection
    @param[in] img image captured by the Point Grey camera
+   @param[in] stamp acquisition time of the image, copied into the published centroids
    @return void
  */
-void ImageProcessing(Mat &img)
+void ImageProcessing(Mat &img, const ros::Time &stamp)
 {
   int key = -1;
   Mat image = (Mat)img;
@@ -206,152 +128,66 @@ void ImageProcessing(Mat &img)
   if (firstframe || key == 32 /*spacebar*/)
   {  // define bg
     firstframe = false;
-    bg = image.clone();
-    cv::imshow("Background", bg);
-    blur(bg, bg, cv::Size(20, 20));
+    background.reset(image, image.rows / 2);
+    cv::imshow("Background", image);
     cv::waitKey(30);
   }
 
-  // subtract BG
-  Mat sub = image - bg;
+  // subtract BG, up half ignore
+  Mat sub;
+  background.subtract(image, sub);
 
-  // up half ignore
-  for (int y = 0; y < sub.rows / 2; y++)
-  {
-    for (int x = 0; x < sub.cols; x++)
-    {
-      sub.at<Vec3b>(Point(x, y))[0] = 0;
-      sub.at<Vec3b>(Point(x, y))[1] = 0;
-      sub.at<Vec3b>(Point(x, y))[2] = 0;
-    }
-  }
-
-  bool pointsToDelete[sub.rows / 2 * sub.cols] = { false };
   int meanX = 0;
   int meanY = 0;
   int boundX = 0;
   int boundY = 0;
   int cntBallPoint = 0;
 
-  uchar Hthreshold = 8;
-  uchar hmax = hue + Hthreshold;
-  uchar hmin = hue - Hthreshold;
+  // hue band +-8, pixels darker than 10 are ignored
+  segmenter.setHue(hue);
+  segmenter.segment(sub, mask, sub.rows / 2);
 
-  bool more_is_less = false;
-  if (hmax < hmin)
-  {
-    more_is_less = true;
-  }
+  // a pixel is kept only if its whole 5x5 neighbourhood is in band
+  support.compute(mask, sub.rows / 2);
 
   for (int y = sub.rows / 2; y < sub.rows; y++)
   {
+    const uchar* in_band = mask.ptr<uchar>(y);
+    Vec3b* out = sub.ptr<Vec3b>(y);
+
     for (int x = 0; x < sub.cols; x++)
     {
-      unsigned char b = sub.at<Vec3b>(Point(x, y))[0];
-      unsigned char g = sub.at<Vec3b>(Point(x, y))[1];
-      unsigned char r = sub.at<Vec3b>(Point(x, y))[2];
-
-      int h = getH(r, g, b);
-      int v = getV(r, g, b);
-
-      if (v < 10)
+      if (!in_band[x] || !support.full(x, y))
       {
-        sub.at<Vec3b>(Point(x, y))[0] = 0;
-        sub.at<Vec3b>(Point(x, y))[1] = 0;
-        sub.at<Vec3b>(Point(x, y))[2] = 0;
+        out[x] = Vec3b(0, 0, 0);
       }
       else
-      {
-        if (((h > (int)hmax && h < (int)hmin) && more_is_less) || ((h > (int)hmax || h < (int)hmin) && !more_is_less))
-        {
-          sub.at<Vec3b>(Point(x, y))[0] = 0;
-          sub.at<Vec3b>(Point(x, y))[1] = 0;
-          sub.at<Vec3b>(Point(x, y))[2] = 0;
-        }
-        else
-        {
-          sub.at<Vec3b>(Point(x, y))[0] = 255;
-          sub.at<Vec3b>(Point(x, y))[1] = 255;
-          sub.at<Vec3b>(Point(x, y))[2] = 255;
-
-          // detect if this points is to be black afterwards
-          int cnt = 0;
-
-          if (sub.at<Vec3b>(Point(x - 1, y))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x - 1, y - 1))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x, y - 1))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x + 1, y - 1))[0] == 255)
-            cnt++;
-
-          if (sub.at<Vec3b>(Point(x - 2, y))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x - 2, y - 1))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x + 2, y - 1))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x - 1, y - 2))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x, y - 2))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x + 1, y - 2))[0] == 255)
-            cnt++;
-
-          if (sub.at<Vec3b>(Point(x - 3, y))[0] == 255)
-            cnt++;
-          if (sub.at<Vec3b>(Point(x, y - 3))[0] == 255)
-            cnt++;
-
-          if (cnt < 12)
-          {
-            pointsToDelete[(y - sub.rows / 2) * sub.cols + x] = true;
-          }
-          else
-          {  // probably ball
-            boundX *= cntBallPoint;
-            boundY *= cntBallPoint;
-
-            cntBallPoint++;
-
-            meanX += x;
-            meanY += y;
-
-            boundX += x;
-            boundY += y;
-
-            boundX /= cntBallPoint;
-            boundY /= cntBallPoint;
-          }
-        }
-      }
-    }
-  }
+      {  // probably ball
+        out[x] = Vec3b(255, 255, 255);
 
-  // delete the points
-  for (int y = sub.rows / 2; y < sub.rows; y++)
-  {
-    for (int x = 0; x < sub.cols; x++)
-    {
-      if (y == sub.rows / 2)
-      {
-        sub.at<Vec3b>(Point(x, y))[0] = 0;
-        sub.at<Vec3b>(Point(x, y))[1] = 0;
-        sub.at<Vec3b>(Point(x, y))[2] = 0;
-      }
-      else if (pointsToDelete[(y - sub.rows / 2) * sub.cols + x] == 1)
-      {
-        sub.at<Vec3b>(Point(x, y))[0] = 0;
-        sub.at<Vec3b>(Point(x, y))[1] = 0;
-        sub.at<Vec3b>(Point(x, y))[2] = 0;
+        boundX *= cntBallPoint;
+        boundY *= cntBallPoint;
+
+        cntBallPoint++;
+
+        meanX += x;
+        meanY += y;
+
+        boundX += x;
+        boundY += y;
+
+        boundX /= cntBallPoint;
+        boundY /= cntBallPoint;
       }
     }
   }
 
+  // learn the background everywhere but on the ball colour
+  background.update(image, mask);
+
   // draw bounding circle
   // or bounding box
-  if (cntBallPoint > 100000)
+  if (cntBallPoint >= minBallPixels)
   {  // if ball detected
     meanX /= cntBallPoint;
     meanY /= cntBallPoint;
@@ -362,7 +198,7 @@ void ImageProcessing(Mat &img)
     int pointy = (meanY - boundY) * 2 + boundY;
 
     // Publish the data
-    PublishBallCenter(image, sub, meanX, meanY, boundX, boundY);
+    PublishBallCenter(image, sub, meanX, meanY, boundX, boundY, stamp);
 
     cv::rectangle(sub, Point(boundX, boundY), Point(pointx, pointy), Scalar(0, 255, 0), 3);
   }
@@ -376,9 +212,10 @@ void ImageProcessing(Mat &img)
    @brief Publishes the detected ball center
    @param[in] centroid detected ball center in pixels
    @param[in] centroidRadius detected ball center in the camera frame
+   @param[in] stamp acquisition time of the image, the centroids are paired with the other sensors by it
    @return void
  */
-void CentroidPub(const pcl::PointXYZ centroid, const pcl::PointXYZ centroidRadius)
+void CentroidPub(const pcl::PointXYZ centroid, const pcl::PointXYZ centroidRadius, const ros::Time &stamp)
 {
   // Method based on solvePnP ================================================
   geometry_msgs::PointStamped CentroidCam;
@@ -387,7 +224,7 @@ void CentroidPub(const pcl::PointXYZ centroid, const pcl::PointXYZ centroidRadiu
   CentroidCam.point.y = centroid.y / 200 - 2.5;
   CentroidCam.point.z = centroid.z;
 
-  CentroidCam.header.stamp = ros::Time::now();
+  CentroidCam.header.stamp = stamp;
   ballCentroidCamPnP_pub.publish(CentroidCam);
 
   // ROS_INFO("(%f,%f,%f)", centroid.x, centroid.y, centroid.z);
@@ -397,7 +234,7 @@ void CentroidPub(const pcl::PointXYZ centroid, const pcl::PointXYZ centroidRadiu
   CentroidCam.point.y = centroidRadius.y;
   CentroidCam.point.z = centroidRadius.z;
 
-  CentroidCam.header.stamp = ros::Time::now();
+  CentroidCam.header.stamp = stamp;
   ballCentroidCam_pub.publish(CentroidCam);
   // std::cout << CentroidCam << std::endl;
 }
@@ -456,8 +293,18 @@ int main(int argc, char **argv)
   node_ns.erase(0, 2);
   n.getParam("ballDiameter", BALL_DIAMETER);
 
+  // 0 keeps the background captured on the first frame / spacebar,
+  // same parameter as ball_detection_node, applied in steps of 1/256
+  double backgroundLearningRate;
+  n.param("background_learning_rate", backgroundLearningRate, 0.02);
+  background.setLearningRate(backgroundLearningRate);
+
+  // smallest ball, in pixels whose whole 5x5 neighbourhood is in band, as in ball_detection_node
+  n.param("min_ball_pixels", minBallPixels, 400);
+
   cout << "Node namespace:" << node_ns << endl;
   cout << "Ball diameter:" << BALL_DIAMETER << endl;
+  cout << "Background learning rate:" << backgroundLearningRate << endl;
   // read calibration paraneters
   string a = "/intrinsic_calibrations/ros_calib.yaml";
   string path = ros::package::getPath("calibration_gui");
@@ -504,7 +351,7 @@ int main(int argc, char **argv)
   {
     if (!cameraRaw.camImage.empty())
     {
-      ImageProcessing(cameraRaw.camImage);
+      ImageProcessing(cameraRaw.camImage, cameraRaw.stamp);
     }
     ros::spinOnce();
   }
@@ -39,6 +39,7 @@
 #include <lidar_segmentation/clustering.h>
 #include <lidar_segmentation/groundtruth.h>
 #include "calibration_gui/visualization_rviz_ldmrs.h"
+#include "calibration_gui/worker_pool.h"
 #include <cmath>
 #include <algorithm>
 #include <sensor_msgs/LaserScan.h>
@@ -66,117 +67,95 @@ ros::Publisher sphereCentroid_pub;
 geometry_msgs::PointStamped sphereCentroid;
 vector <int> scan_ldmrs_header;
 
+//Threads that process the four layers of each scan
+WorkerPoolPtr layer_pool;
+
 /**
-   @brief Handler for the incoming data
+   @brief Cluster one layer of the scan and look for the ball section on it
+   @param[in] n index of the layer
    @param[in] lidarPoints incoming Laser Points
-   @param[in] iterations iteration of the Laser Scan
+   @param[out] clusters clusters of every layer, only slot n is written
+   @param[out] circlePoints points of the detected circles, only slot n is written
+   @param[out] radius radius of the detected circles, only slot n is written
+   @param[out] center centre of the detected circles, only slot n is written
    @return void
  */
-void dataFromFileHandler(vector<MultiScanPtr>& lidarPoints, vector<int> iterations)
+void findLayerCircle(int n, vector<MultiScanPtr>& lidarPoints, vector<LidarClustersPtr>& clusters,
+                     vector<LidarClustersPtr>& circlePoints, vector<double>& radius, vector<geometry_msgs::Point>& center)
 {
-	vector<LidarClustersPtr> clusters;
-	vector<LidarClustersPtr> circlePoints;
-	vector<double> radius;
-	vector<geometry_msgs::Point> center;
-	Point sphere;
-
-	pcl::PointCloud<pcl::PointXYZ>::Ptr cloud (new pcl::PointCloud<pcl::PointXYZ>);
-
-	for(int n=0; n<lidarPoints.size(); n++)
-	{
-		vector<PointPtr> groundtruth_points = lidarPoints[n]->Points;
-
-		int iteration = iterations[n];
-
-		//cout << "Scan number: " << iteration << endl;
+	vector<PointPtr> groundtruth_points = lidarPoints[n]->Points;
 
-		vector<PointPtr> groundtruth_points_filtered;
+	vector<PointPtr> groundtruth_points_filtered;
 
-		//Filter the laser points
-		filterPoints(groundtruth_points,groundtruth_points_filtered,0.01,200.);
+	//Filter the laser points
+	filterPoints(groundtruth_points,groundtruth_points_filtered,0.01,200.);
 
-		//Sort them by label
-		vector<PointPtr> groundtruth_points_filtered_sorted  =  groundtruth_points_filtered;
-		sort(groundtruth_points_filtered_sorted.begin(),groundtruth_points_filtered_sorted.end(),comparePoints);
+	//The points keep the order of the scan, so neighbours are found in a single pass
+	LidarClustersPtr cluster (new LidarClusters);
+	vector<ClusterPtr> clusters_nn;
+	double threshold_nn = 0.20;
+	scanClustering( groundtruth_points_filtered, threshold_nn, clusters_nn);
 
-		//-------------------------------------------------------------------------------------------------------------------
-		//Make GT clusters
+	cluster->Clusters = clusters_nn;
+	clusters[n] = cluster;
 
-		vector<ClusterPtr> clusters_GT;
-		convertPointsToCluster(groundtruth_points_filtered_sorted, clusters_GT);
-		//Remove GT clusters with less than a certain size
-		uint minimum_points = 3;
-		vector<PointPtr> groundtruth_small_points_removed = groundtruth_points_filtered;
-		removeInvalidPoints(groundtruth_small_points_removed, clusters_GT, minimum_points);
-
-		//      convertPointsToCluster(groundtruth_points_filtered , clusters_GTs);
-		LidarClustersPtr cluster (new LidarClusters);
-		vector<ClusterPtr> clusters_nn;
-		double threshold_nn = 0.20;
-		nnClustering( groundtruth_points_filtered, threshold_nn, clusters_nn);
-
-		cluster->Clusters = clusters_nn;
-		clusters.push_back(cluster);
-
-		LidarClustersPtr circlePs (new LidarClusters);
-		vector<ClusterPtr> circleP;
-		double r;
-		r=find_circle(clusters_nn,circleP,n);
-		int num;
-		if(r!=0)
-			num++;
-		radius.push_back(r);
-		circlePs->Clusters = circleP;
-		circlePoints.push_back(circlePs);
+	LidarClustersPtr circlePs (new LidarClusters);
+	vector<ClusterPtr> circleP;
+	radius[n]=find_circle(clusters_nn,circleP,n,center[n]);
+	circlePs->Clusters = circleP;
+	circlePoints[n] = circlePs;
+}
 
-		//publish circle centroid
+/**
+   @brief Handler for the incoming data
+   @param[in] lidarPoints incoming Laser Points
+   @param[in] iterations iteration of the Laser Scan
+   @param[in] stamp acquisition time of the scans, copied into the published centroid
+   @return void
+ */
+void dataFromFileHandler(vector<MultiScanPtr>& lidarPoints, vector<int> iterations, const ros::Time& stamp)
+{
+	int layers = lidarPoints.size();
+	vector<LidarClustersPtr> clusters(layers);
+	vector<LidarClustersPtr> circlePoints(layers);
+	vector<double> radius(layers, 0);
+	vector<geometry_msgs::Point> center(layers);
+	Point sphere;
 
-		center.push_back(sphereCentroid.point);
+	//The layers are independent until the centroid fusion, each one writes only its own slot
+	layer_pool->run(layers, boost::bind(findLayerCircle, _1, boost::ref(lidarPoints), boost::ref(clusters),
+	                                    boost::ref(circlePoints), boost::ref(radius), boost::ref(center)));
 
+	//publish circle centroid
+	if(layers==4)
+	{
 		int circlesNumb = 0;
-		if(n==3)
+		for(int i=0; i<4; i++)
 		{
-			for(int i=0; i<4; i++)
-			{
-				if(radius[i]>0.001)
-					circlesNumb++;
-			}
+			if(radius[i]>0.001)
+				circlesNumb++;
 		}
 
-		if(n==3)
+		if(circlesNumb>1)
 		{
-			// cout<<"radius 1 "<<radius[0]<<endl;
-			// cout<<"radius 2 "<<radius[1]<<endl;
-			// cout<<"radius 3 "<<radius[2]<<endl;
-			// cout<<"radius 4 "<<radius[3]<<endl;
+			calculateSphereCentroid(center, sphereCentroid, radius);
+			sphere.x=sphereCentroid.point.x;
+			sphere.y=sphereCentroid.point.y;
+			sphere.z=sphereCentroid.point.z;
 		}
-
-		if(n==3)
+		else
 		{
-			if(circlesNumb>1)
-			{
-				calculateSphereCentroid(center, sphereCentroid, radius);
-				sphere.x=sphereCentroid.point.x;
-				sphere.y=sphereCentroid.point.y;
-				sphere.z=sphereCentroid.point.z;
-			}
-			else
-			{
-				sphere.x=-100;
-				sphere.y=0;
-				sphere.z=0;
-			}
-			sphereCentroid.header.stamp = ros::Time::now();
-			sphereCentroid_pub.publish(sphereCentroid);
+			sphereCentroid.point=center[3];
+			sphere.x=-100;
+			sphere.y=0;
+			sphere.z=0;
 		}
+		sphereCentroid.header.stamp = stamp;
+		sphereCentroid_pub.publish(sphereCentroid);
 	}
-	vector<ClusterPtr> linePoints;
 	//      Vizualize the Segmentation results
 
-	visualization_msgs::MarkerArray targets_markers;
-	targets_markers.markers = createTargetMarkers(clusters,circlePoints, sphere,radius);
-
-	markers_ldmrs_pub.publish(targets_markers);
+	markers_ldmrs_pub.publish(createTargetMarkers(clusters,circlePoints, sphere,radius));
 
 	//cout<<"done all"<<endl;
 
@@ -281,153 +260,57 @@ void calculateSphereCentroid(vector<geometry_msgs::Point> center, geometry_msgs:
    @param[in] clusters segmented scan from the laser
    @param[out] circleP point coordinates of the circle detected for representation on rviz
    @param[in] layer number of the scan
+   @param[out] center centre of the detected circle, -999 if none was found
    @return double radius of the detected circle
  */
-double find_circle(vector<ClusterPtr> clusters, vector<ClusterPtr>& circleP, int layer)
+double find_circle(vector<ClusterPtr> clusters, vector<ClusterPtr>& circleP, int layer, geometry_msgs::Point& center)
 {
+	center.x=-999;
+	center.y=-999;
+	center.z=-999;
 	int count=0;
 	double radius=0;
-	bool checkCircle = false;
+
+	//rotation of the layer in relation to the XY plane
+	double Angle=0;
+	if(layer==0)
+		Angle=-1.2*M_PI/180;
+	else if(layer==1)
+		Angle=-0.4*M_PI/180;
+	else if(layer==2)
+		Angle=0.4*M_PI/180;
+	else if(layer==3)
+		Angle=1.2*M_PI/180;
+
+	//if (m>90 && m<135 && std < 8.6)
+	//if (m>90 && m<145 && std < 12) // ATLASCAR
+	CircleDetector detector(5, 90, 145, 8.5, 1.2*BALL_DIAMETER);
+
 	for(int k=0; k<clusters.size(); k++)
 	{
 		ClusterPtr cluster=clusters[k];
-		int segment_init, segment_end;
-		for (int i=0; i<cluster->support_points.size(); i++)
-		{
 
-			segment_init=0;
-			segment_end=cluster->support_points.size()-1;
-
-			// Detect if at least 6 points
-			double angle[1000];
-			double angle_std;
-			double vecA[3],vecB[3];
-			int n=0;
-			if (segment_end-segment_init>=5)
-			{
-				for (int j=segment_init+1; j<segment_end-1; j++)
-				{
-					// use 3D but actually Z = 0 because laserscan is planar
-					vecA[0] = cluster->support_points[segment_init]->x - cluster->support_points[j]->x;
-					vecA[1] = cluster->support_points[segment_init]->y - cluster->support_points[j]->y;
-					vecA[2] = cluster->support_points[segment_init]->z - cluster->support_points[j]->z;
-
-					vecB[0] = cluster->support_points[segment_end]->x - cluster->support_points[j]->x;
-					vecB[1] = cluster->support_points[segment_end]->y - cluster->support_points[j]->y;
-					vecB[2] = cluster->support_points[segment_end]->z - cluster->support_points[j]->z;
-
-					angle[n] = acos( inner_product(vecA, vecA+3, vecB, 0.0)
-					                 / (sqrt(pow(vecA[0],2) + pow(vecA[1],2) + pow(vecA[2],2)) * sqrt(pow(vecB[0],2) + pow(vecB[1],2) + pow(vecB[2],2))));
-					n++;
-				}
-				// compute average angle and std
-				double m=0;
-				double std=0;
-
-				for (int j = 0; j < n; j++)
-					m += angle[j];
-
-				m = m/n;
-				for ( int j = 0; j < n; j++ )
-				{
-					std += pow((angle[j]-m),2);
-				}
-
-				std = sqrt(std/(n-1));
-
-				// conversion to degree
-				m = m/M_PI*180;
-				std = std/M_PI*180;
-
-				//if (m>90 && m<135 && std < 8.6)
-				//if (m>90 && m<145 && std < 12) // ATLASCAR
-				if (m>90 && m<145 && std < 8.5)
-				{
-					// std::cout << "std = " << std << std::endl;
-					// std::cout << "m = " << m << std::endl;
-					double ma,mb,cx,x1,x2,x3,cy,y1,y2,y3,z1,z2,z3;
-					x1=cluster->support_points[segment_init]->x;
-					x2=cluster->support_points[round(segment_end/2)]->x;
-					x3=cluster->support_points[segment_end]->x;
-					y1=cluster->support_points[segment_init]->y;
-					y2=cluster->support_points[round(segment_end/2)]->y;
-					y3=cluster->support_points[segment_end]->y;
-					z1=cluster->support_points[segment_init]->z;
-					z2=cluster->support_points[round(segment_end/2)]->z;
-					z3=cluster->support_points[segment_end]->z;
-
-					//rotate da points to da plane XY
-					double Angle;
-					if(layer==0)
-						Angle=-1.2*M_PI/180;
-					else if(layer==1)
-						Angle=-0.4*M_PI/180;
-					else if(layer==2)
-						Angle=0.4*M_PI/180;
-					else if(layer==3)
-						Angle=1.2*M_PI/180;
-
-					for(int i=0; i<cluster->support_points.size(); i++)
-						rotatePoints(cluster->support_points[i]->x,cluster->support_points[i]->y, cluster->support_points[i]->z, Angle);
-
-					Point centroid;
-					double R;
-					CalculateCircle(cluster,R,centroid);
-
-					double z=0;
-					rotatePoints(centroid.x,centroid.y,z,-Angle);
-
-					for(int i=0; i<cluster->support_points.size(); i++)
-						rotatePoints(cluster->support_points[i]->x,cluster->support_points[i]->y, cluster->support_points[i]->z, -Angle);
-
-
-					rotatePoints(x1,y1, z1, Angle);
-					rotatePoints(x2,y2, z2, Angle);
-					rotatePoints(x3,y3, z3, Angle);
-
-					ma=(y2-y1)/(x2-x1);
-					mb=(y3-y2)/(x3-x2);
-
-					cx=(ma*mb*(y1-y3)+mb*(x1+x2)-ma*(x2+x3))/(2*(mb-ma));
-					cy=-1/ma*(cx-(x1+x2)/2)+(y1+y2)/2;
-
-					radius=sqrt(pow((cx-x1),2) + pow((cy-y1),2));
-					radius=R;
-
-					rotatePoints(cx,cy,z1,-Angle);
-					double circle[3];
-					circle[0]=centroid.x;
-					circle[1]=centroid.y;
-					circle[2]=z;
-
-					double centre[3];
-					centre[0] = circle[0];
-					centre[1] = circle[1];
-					centre[2] = circle[2];
-
-					sphereCentroid.point.x=circle[0];
-					sphereCentroid.point.y=circle[1];
-					sphereCentroid.point.z=circle[2];
-
-					circlePoints(circleP,radius,centre,20);
-					if(!circleP.empty())
-						circleP[count]->centroid=cluster->centroid;
-					count++;
-					checkCircle=true;
-				}
-				else
-				{
-					if(checkCircle==false)
-					{
-						sphereCentroid.point.x=-999;
-						sphereCentroid.point.y=-999;
-						sphereCentroid.point.z=-999;
-					}
-				}
-			}
-		}
+		Point centroid;
+		double R;
+		if(!detector.detect(cluster,Angle,R,centroid))
+			continue;
+
+		radius=R;
+
+		double centre[3];
+		centre[0] = centroid.x;
+		centre[1] = centroid.y;
+		centre[2] = centroid.z;
+
+		center.x=centre[0];
+		center.y=centre[1];
+		center.z=centre[2];
+
+		circlePoints(circleP,radius,centre,20);
+		if(!circleP.empty())
+			circleP[count]->centroid=cluster->centroid;
+		count++;
 	}
-	cout<<"R "<<radius<<endl;
 	return radius;
 }
 
@@ -499,6 +382,12 @@ int main(int argc, char **argv)
 	cout << "Node namespace:" << node_ns << endl;
 	cout << "Ball diameter:" << BALL_DIAMETER << endl;
 
+	//The calling thread works on one layer too, so three extra threads cover the four layers
+	int layerThreads;
+	n.param("layerThreads", layerThreads, 3);
+	cout << "Layer threads:" << layerThreads << endl;
+	layer_pool.reset(new WorkerPool(layerThreads));
+
 	sickLDMRSscan scan(node_ns);
 
 	markers_ldmrs_pub = n.advertise<visualization_msgs::MarkerArray>( "BallDetection", 10000);
@@ -556,7 +445,7 @@ int main(int argc, char **argv)
 			scan_ldmrs_header.push_back(data_gt[3]->iteration);
 
 
-			dataFromFileHandler(lidarPoints, scan_ldmrs_header);
+			dataFromFileHandler(lidarPoints, scan_ldmrs_header, scan.scan0.header.stamp);
 		}
 		ros::spinOnce();
 		loop_rate.sleep();
@@ -58,10 +58,11 @@ int checkCircle=0;
    @brief Handler for the incoming data
    @param[in] groundtruth_points incoming Laser Points
    @param[in] iteration iteration of the Laser Scan
+   @param[in] stamp acquisition time of the scan, copied into the published centroid
    @return void
  */
 
-void dataFromFileHandler(vector<PointPtr>& groundtruth_points, int iteration)
+void dataFromFileHandler(vector<PointPtr>& groundtruth_points, int iteration, const ros::Time& stamp)
 {
 	//cout << "Scan number: " << iteration << endl;
 
@@ -70,27 +71,14 @@ void dataFromFileHandler(vector<PointPtr>& groundtruth_points, int iteration)
 	//Filter the laser points
 	filterPoints(groundtruth_points,groundtruth_points_filtered,0.01,50);
 	//cout<<"end"<<endl;
-	//Sort them by label
-	vector<PointPtr> groundtruth_points_filtered_sorted  =  groundtruth_points_filtered;
-	sort(groundtruth_points_filtered_sorted.begin(),groundtruth_points_filtered_sorted.end(),comparePoints);
-
-	//-------------------------------------------------------------------------------------------------------------------
-	//Make GT clusters
-
-	vector<ClusterPtr> clusters_GT;
-	convertPointsToCluster(groundtruth_points_filtered_sorted, clusters_GT);
-	//Remove GT clusters with less than a certain size
-	uint minimum_points = 3;
-	vector<PointPtr> groundtruth_small_points_removed = groundtruth_points_filtered;
-	removeInvalidPoints(groundtruth_small_points_removed, clusters_GT, minimum_points);
-
+	//The points keep the order of the scan, so neighbours are found in a single pass
 	vector<ClusterPtr> clusters_nn;
 	double threshold_nn = 0.2;
-	nnClustering( groundtruth_points_filtered, threshold_nn, clusters_nn);
+	scanClustering( groundtruth_points_filtered, threshold_nn, clusters_nn);
 
 	vector<ClusterPtr> circle;
 	Point sphere;
-	find_circle(clusters_nn,circle,sphere);
+	find_circle(clusters_nn,circle,sphere,stamp);
 	//      Vizualize the Segmentation results
 
 	visualization_msgs::MarkerArray targets_markers;
@@ -116,169 +104,78 @@ void dataFromFileHandler(vector<PointPtr>& groundtruth_points, int iteration)
    @param[in] clusters segmented scan from the laser
    @param[out] circleP point coordinates of the circle detected for representation on rviz
    @param[out] sphere coordinates of the sphere centroid
+   @param[in] stamp acquisition time of the scan, copied into the published centroid
    @return double radius of the detected circle
  */
-double find_circle(vector<ClusterPtr> clusters, vector<ClusterPtr>& circleP, Point & sphere)
+double find_circle(vector<ClusterPtr> clusters, vector<ClusterPtr>& circleP, Point & sphere, const ros::Time& stamp)
 {
 	geometry_msgs::PointStamped centroid;
 	centroid.point.x=-999;
 	centroid.point.y=-999;
 	centroid.point.z=-999;
 	int count=0;
+	double ballDiameter = BALL_DIAMETER;
+
+	// Apply algorithm from
+	/*Fast Line, Arc/Circle and Leg Detection from
+	   Laser Scan Data in a Player Driver
+	   João Xavier∗ , Marco Pacheco† , Daniel Castro† , António Ruano† and Urbano Nunes*/
+	//if (m>90 && m<140 && std < 7.5)
+	CircleDetector detector(6, 105, 140, 5, 1.2*ballDiameter);
+
 	for(int k=0; k<clusters.size(); k++)
 	{
 		ClusterPtr cluster=clusters[k];
-		int segment_init, segment_end;
-		for (int i=0; i<cluster->support_points.size(); i++)
+
+		Point Centroid;
+		double radius;
+		if(!detector.detect(cluster,0,radius,Centroid))
 		{
-			// Apply algorithm from
-			/*Fast Line, Arc/Circle and Leg Detection from
-			   Laser Scan Data in a Player Driver
-			   João Xavier∗ , Marco Pacheco† , Daniel Castro† , António Ruano† and Urbano Nunes*/
-
-			segment_init=0;
-			segment_end=cluster->support_points.size()-1;
-
-			// Detect if at least 6 points
-			double angle[1000];
-			double angle_std;
-			double vecA[3],vecB[3];
-			int n=0;
-			if (segment_end-segment_init>=6)
+			if(checkCircle==0 && (int)cluster->support_points.size()-1>=detector.min_span)
 			{
-				for (int j=segment_init+1; j<segment_end-1; j++)
-				{
-					// use 3D but actually Z = 0 because laserscan is planar
-					vecA[0] = cluster->support_points[segment_init]->x - cluster->support_points[j]->x;
-					vecA[1] = cluster->support_points[segment_init]->y - cluster->support_points[j]->y;
-					vecA[2] = cluster->support_points[segment_init]->z - cluster->support_points[j]->z;
-
-					vecB[0] = cluster->support_points[segment_end]->x - cluster->support_points[j]->x;
-					vecB[1] = cluster->support_points[segment_end]->y - cluster->support_points[j]->y;
-					vecB[2] = cluster->support_points[segment_end]->z - cluster->support_points[j]->z;
-
-					angle[n] = acos( inner_product(vecA, vecA+3, vecB, 0.0)
-					                 / (sqrt(pow(vecA[0],2) + pow(vecA[1],2) + pow(vecA[2],2)) * sqrt(pow(vecB[0],2) + pow(vecB[1],2) + pow(vecB[2],2))));
-					n++;
-				}
-
-
-				// compute average angle and std
-				double m=0;
-				double std=0;
-
-				for (int j = 0; j < n; j++)
-					m += angle[j];
-
-				m = m/n;
-				for ( int j = 0; j < n; j++ )
-				{
-					std += pow((angle[j]-m),2);
-				}
-
-				std = sqrt(std/(n-1));
-
-				// conversion to degree
-				m = m/M_PI*180;
-				std = std/M_PI*180;
-
-				//std::cout << "std = " << std << std::endl;
-				//std::cout << "m = " << m << std::endl;
-
-				//if (m>90 && m<140 && std < 7.5)
-				if (m>105 && m<140 && std < 5)
-				{
-					// Circle information computation
-					double theta = (m-90)/180*M_PI;
-					// use 3D but actually Z = 0 because laserscan is planar
-					double middle[3];
-					middle[0] = (cluster->support_points[segment_end]->x - cluster->support_points[segment_init]->x)/2;
-					middle[1] = (cluster->support_points[segment_end]->y - cluster->support_points[segment_init]->y)/2;
-					middle[2] = (cluster->support_points[segment_end]->z - cluster->support_points[segment_init]->z)/2;
-
-					double h = sqrt(pow(middle[0],2) + pow(middle[1],2) + pow(middle[2],2)) * tan(theta);
-					double height[3];
-					height[1]= sqrt( (middle[0]*middle[0]*h*h) / (middle[0]*middle[0] + middle[1]*middle[1]) );
-					height[0]= -middle[1]*height[1]/middle[0];
-					height[2]= 0;
-
-					double circle[3], radius;
-					circle[0] = cluster->support_points[segment_init]->x + middle[0] - height[0];
-					circle[1] = cluster->support_points[segment_init]->y + middle[1] - height[1];
-					circle[2] = cluster->support_points[segment_init]->z + middle[2] - height[2];
-					//radius = sqrt(pow((circle[0]-cluster->support_points[segment_init]->x),2) + pow((circle[1]-cluster->support_points[segment_init]->y),2) + pow((circle[2]-cluster->support_points[segment_init]->z),2));
-
-					double ma,mb,cx,x1,x2,x3,cy,y1,y2,y3;
-					x1=cluster->support_points[segment_init]->x;
-					x2=cluster->support_points[round(segment_end/2)]->x;
-					x3=cluster->support_points[segment_end]->x;
-					y1=cluster->support_points[segment_init]->y;
-					y2=cluster->support_points[round(segment_end/2)]->y;
-					y3=cluster->support_points[segment_end]->y;
-
-					ma=(y2-y1)/(x2-x1);
-					mb=(y3-y2)/(x3-x2);
-
-					cx=(ma*mb*(y1-y3)+mb*(x1+x2)-ma*(x2+x3))/(2*(mb-ma));
-					cy=-1/ma*(cx-(x1+x2)/2)+(y1+y2)/2;
-
-					//radius=sqrt(pow((cx-x1),2) + pow((cy-y1),2));
-
-					Point Centroid;
-					double R;
-					CalculateCircle(cluster,R,Centroid);
-					radius=R;
-					cout << "Radius = " << radius << endl; // DEBUGGING
-
-					double ballDiameter = BALL_DIAMETER;
-
-					// Determines if the radius is valid or not
-					if(radius > ballDiameter/2  || radius <= 0) // invalid
-					{
-						sphere.x=-10000;
-						sphere.y=centroid.point.y;
-						sphere.z=centroid.point.z;
-						double centre[3];
-						centre[0] = Centroid.x;
-						centre[1] = Centroid.y;
-						centre[2] = 0;
-						circlePoints(circleP,radius,centre,20);
-					}
-					else // valid radius
-					{
-						// std::cout << "valid" << ballDiameter/2 << std::endl;
-						centroid.point.x=Centroid.x;
-						centroid.point.y=Centroid.y;
-            centroid.point.z=-(sqrt(pow(ballDiameter/2,2)-pow(radius,2)));
-						sphere.x=centroid.point.x;
-						sphere.y=centroid.point.y;
-						sphere.z=centroid.point.z;
-						//cout<<"x "<<centroid.point.x<<endl;
-						double centre[3];
-						centre[0] = Centroid.x;
-						centre[1] = Centroid.y;
-						centre[2] = centroid.point.z;
-						circlePoints(circleP,radius,centre,20);
-					}
-
-					if(!circleP.empty())
-						circleP[count]->centroid=cluster->centroid;
-					count++;
-					checkCircle=1;
-				}
-				else
-				{
-					if(checkCircle==0)
-					{
-						sphere.x=-10000;
-						sphere.y=centroid.point.y;
-						sphere.z=centroid.point.z;
-					}
-				}
+				sphere.x=-10000;
+				sphere.y=centroid.point.y;
+				sphere.z=centroid.point.z;
 			}
+			continue;
 		}
+		cout << "Radius = " << radius << endl; // DEBUGGING
+
+		// Determines if the radius is valid or not
+		if(radius > ballDiameter/2  || radius <= 0) // invalid
+		{
+			sphere.x=-10000;
+			sphere.y=centroid.point.y;
+			sphere.z=centroid.point.z;
+			double centre[3];
+			centre[0] = Centroid.x;
+			centre[1] = Centroid.y;
+			centre[2] = 0;
+			circlePoints(circleP,radius,centre,20);
+		}
+		else // valid radius
+		{
+			// std::cout << "valid" << ballDiameter/2 << std::endl;
+			centroid.point.x=Centroid.x;
+			centroid.point.y=Centroid.y;
+			centroid.point.z=-(sqrt(pow(ballDiameter/2,2)-pow(radius,2)));
+			sphere.x=centroid.point.x;
+			sphere.y=centroid.point.y;
+			sphere.z=centroid.point.z;
+			//cout<<"x "<<centroid.point.x<<endl;
+			double centre[3];
+			centre[0] = Centroid.x;
+			centre[1] = Centroid.y;
+			centre[2] = centroid.point.z;
+			circlePoints(circleP,radius,centre,20);
+		}
+
+		if(!circleP.empty())
+			circleP[count]->centroid=cluster->centroid;
+		count++;
+		checkCircle=1;
 	}
-	centroid.header.stamp=ros::Time::now();
+	centroid.header.stamp=stamp;
 	circleCentroid_pub.publish(centroid);
 }
 
@@ -319,7 +216,7 @@ int main(int argc, char **argv)
 			createPointsFromFile(points, data_gt);
 			scan_lms_header=data_gt->iteration;
 
-			dataFromFileHandler(points, scan_lms_header);
+			dataFromFileHandler(points, scan_lms_header, scan.scanLaser.header.stamp);
 		}
 
 		ros::spinOnce();
@@ -44,6 +44,7 @@
 #include <pcl/sample_consensus/sac_model_sphere.h>
 #include <pcl/io/pcd_io.h>
 #include "calibration_gui/visualization_rviz_swissranger.h"
+#include "calibration_gui/organized_sphere_search.h"
 #include <visualization_msgs/MarkerArray.h>
 #include <geometry_msgs/PointStamped.h>
 
@@ -58,6 +59,8 @@
 ros::Publisher markers_pub;
 ros::Publisher sphereCenter_pub;
 ros::Publisher pointCloud_pub;
+OrganizedSphereSearch organized_search;
+SphereFitter cloud_fitter;
 
 /**
    @brief write in a file the center of the sphere
@@ -74,9 +77,10 @@ void writeFile(Eigen::VectorXf sphereCoeffsRefined)
 /**
    @brief Detection of the ball on the sensor data
    @param[in] SwissRanger_cloud point cloud from the swissranger
+   @param[in] stamp acquisition time of the data, copied into the published centroid
    @return void
  */
-void sphereDetection(pcl::PointCloud<pcl::PointXYZ> SwissRanger_cloud)
+void sphereDetection(const pcl::PointCloud<pcl::PointXYZ>& SwissRanger_cloud, const ros::Time& stamp)
 {
 
 	ros::Time start = ros::Time::now();
@@ -208,51 +212,57 @@ void sphereDetection(pcl::PointCloud<pcl::PointXYZ> SwissRanger_cloud)
 	             << coefficients->values[3] << endl;
 	   }*/
 
-	/* METHOD #4 ================================================================
-	 * Detects the ball up to 3 meters, fast. Optimized Method #3
+	/* METHOD #5 ================================================================
+	 * The organized cloud is a depth image: spheres are fitted only on the blobs
+	 * of the ball size, starting with the one closest to the last detection
 	 */
-	pcl::PointCloud<pcl::PointXYZ>::Ptr SR_cloudPtr (new pcl::PointCloud<pcl::PointXYZ>(SwissRanger_cloud));
+	bool found = false;
+	if(organized_search.enabled && SwissRanger_cloud.height>1)
+	{
+		SphereFit sphere;
+		found = organized_search.detect(SwissRanger_cloud, sphere);
 
-	pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_p (new pcl::PointCloud<pcl::PointXYZ>);
+		ros::Time end = ros::Time::now();
 
-	pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients ());
-	pcl::PointIndices::Ptr inliers (new pcl::PointIndices ());
+		cout << "Ball detection time organized: " <<  (end - start).toNSec() * 1e-6 << " msec"  << endl;
 
-	// Create the segmentation object
-	pcl::SACSegmentation<pcl::PointXYZ> seg;
-	// Optional
-	seg.setOptimizeCoefficients (true);
-	// Mandatory
-	seg.setModelType (pcl::SACMODEL_SPHERE);
-	seg.setMethodType (pcl::SAC_RANSAC);
-	seg.setMaxIterations (10000);
-	seg.setDistanceThreshold (0.0070936);
-	seg.setProbability(0.99);
-	seg.setRadiusLimits (BALL_DIAMETER/2-0.05, BALL_DIAMETER/2+0.05);
-	seg.setInputCloud (SR_cloudPtr);
-	seg.segment (*inliers, *coefficients);
+		if(found)
+		{
+			sphereCenter.point.x = sphere.center(0);
+			sphereCenter.point.y = sphere.center(1);
+			sphereCenter.point.z = sphere.center(2);
 
-	ros::Time end = ros::Time::now();
+			cout << "Accepted: " << sphere << endl;
+		}
+	}
 
-	cout << "Ball detection time filtered: " <<  (end - start).toNSec() * 1e-6 << " msec"  << endl;
+	// No blob of the ball size (e.g. a hand-held ball, joined in depth to the arm)
+	// or no sphere on them: fit on the whole cloud as when the search is off
+	if(!found)
+	{
+		/* METHOD #4 ================================================================
+		 * Detects the ball up to 3 meters, fast. Optimized Method #3
+		 */
+		SphereFit sphere;
+		found = cloud_fitter.fit(SwissRanger_cloud, NULL, sphere);
 
-	cout << *coefficients << endl;
+		ros::Time end = ros::Time::now();
 
-	if(inliers->indices.size ()>0)
-	{
+		cout << "Ball detection time filtered: " <<  (end - start).toNSec() * 1e-6 << " msec"  << endl;
 
-		if (coefficients->values[3]<BALL_DIAMETER/2 + 0.05*BALL_DIAMETER/2 && coefficients->values[3]>BALL_DIAMETER/2 - 0.05*BALL_DIAMETER/2)
-		{
-			sphereCenter.point.x = coefficients->values[0];
-			sphereCenter.point.y = coefficients->values[1];
-			sphereCenter.point.z = coefficients->values[2];
+		cout << sphere << endl;
 
+		if(found)
+		{
+			sphereCenter.point.x = sphere.center(0);
+			sphereCenter.point.y = sphere.center(1);
+			sphereCenter.point.z = sphere.center(2);
 
-			cout << "Accepted: " << *coefficients << endl;
+			cout << "Accepted: " << sphere << endl;
 		}
 	}
 
-	sphereCenter.header.stamp = ros::Time::now();
+	sphereCenter.header.stamp = stamp;
 	sphereCenter_pub.publish(sphereCenter);
 
 	pcl::PointXYZ center;
@@ -283,6 +293,22 @@ int main(int argc, char **argv)
 	cout << "Node namespace:" << node_ns << endl;
 	cout << "Ball diameter:" << BALL_DIAMETER << endl;
 
+	// The driver publishes the pixels row by row, without the image size
+	int imageWidth, imageHeight;
+	n.param("imageWidth", imageWidth, 176);
+	n.param("imageHeight", imageHeight, 144);
+	organized_search.ball_diameter = BALL_DIAMETER;
+	organized_search.readParameters(n);
+	cout << "Organized search:" << organized_search.enabled << endl;
+
+	// Whole cloud fit, used when the cloud is not organized or the organized search fails: the ball is a small part of the cloud
+	cloud_fitter.radius = BALL_DIAMETER/2;
+	cloud_fitter.radius_tolerance = 0.05*BALL_DIAMETER/2;
+	cloud_fitter.max_iterations = 10000;
+	cloud_fitter.time_budget = 0.1;
+	cloud_fitter.min_inlier_ratio = 0;
+	cloud_fitter.readParameters(n, "cloudSphere");
+
 	markers_pub = n.advertise<visualization_msgs::MarkerArray>( "BallDetection", 10000);
 	sphereCenter_pub = n.advertise<geometry_msgs::PointStamped>("SphereCentroid",1000);
 	pointCloud_pub = n.advertise<sensor_msgs::PointCloud>("Pointcloud",10000);
@@ -296,6 +322,7 @@ int main(int argc, char **argv)
 		if(cloud.cloud.points.size()>0)
 		{
 			pcl::PointCloud<pcl::PointXYZ> SwissRanger_cloud;
+			SwissRanger_cloud.reserve(cloud.cloud.points.size());
 			pcl::PointXYZ p;
 			for(int i=0; i<cloud.cloud.points.size(); i++)
 			{
@@ -304,7 +331,12 @@ int main(int argc, char **argv)
 				p.z=cloud.cloud.points[i].z;
 				SwissRanger_cloud.push_back(p);
 			}
-			sphereDetection(SwissRanger_cloud);
+			if(SwissRanger_cloud.points.size()==imageWidth*imageHeight)
+			{
+				SwissRanger_cloud.width=imageWidth;
+				SwissRanger_cloud.height=imageHeight;
+			}
+			sphereDetection(SwissRanger_cloud, cloud.stamp);
 			cloud.cloud.header.frame_id = "/my_frame";
 			cloud.cloud.header.stamp = ros::Time::now();
 			pointCloud_pub.publish(cloud.cloud);
@@ -19,6 +19,9 @@
 #include <pcl/segmentation/progressive_morphological_filter.h>
 #include <pcl/sample_consensus/ransac.h>
 #include <pcl/sample_consensus/sac_model_sphere.h>
+#include <pcl/sample_consensus/sac_model_plane.h>
+
+#include <cstring>
 
 /*---Velodyne Package Includes---*/
 #include "velodyne_pointcloud/rawdata.h"
@@ -31,7 +34,9 @@
 /*---Calobration Package Includes---*/
 #include "calibration_gui/velodyne_vlp16.h"
 #include "calibration_gui/common_functions.h"
+#include "calibration_gui/sphere_fitter.h"
 #include "calibration_gui/visualization_rviz_velodyne.h"
+#include "calibration_gui/worker_pool.h"
 
 
 using namespace ros;
@@ -41,85 +46,94 @@ geometry_msgs::PointStamped sphereCentroid;
 Publisher sphereCentroid_pub;
 Publisher velodyne_pub;
 
+// Threads that process the rings of each scan
+WorkerPoolPtr ring_pool;
+
 
-void getClusters(vector<PointPtr> laserPoints, vector<ClusterPtr> * clusters_nn){
+void getClusters(const vector<PointPtr> &laserPoints, vector<ClusterPtr> * clusters_nn){
 
+  // The points of a ring are in firing order, so neighbours are found in a single pass
   double threshold_nn = 0.1;
-  nnClustering( laserPoints, threshold_nn , *clusters_nn);
+  scanClustering( laserPoints, threshold_nn , *clusters_nn);
 }
 
 /**
-   @brief Handler for the incoming data
-   @param[in] lidarPoints incoming Laser Points
-   @param[in] iterations iteration of the Laser Scan
+   @brief Cluster one ring and look for the ball section on it
+   @param[in] i index of the ring in laserscans
+   @param[in] laserscans points of the used rings
+   @param[out] clusters clusters of every ring, only slot i is written
+   @param[out] circlePoints points of the detected circles, only slot i is written
+   @param[out] radius radius of the detected circles, only slot i is written
+   @param[out] center centre of the detected circles, only slot i is written
    @return void
  */
-void velodyne_findBall(vector< vector<PointPtr> > laserscans)
+void findRingCircle(int i, const vector< vector<PointPtr> > &laserscans, vector<LidarClustersPtr> &clusters,
+                    vector<LidarClustersPtr> &circlePoints, vector<double> &radius, vector<geometry_msgs::Point> &center)
 {
-  vector<LidarClustersPtr> clusters;
-  vector<LidarClustersPtr> circlePoints;
-  vector<double> radius;
-  vector<geometry_msgs::Point> center;
-  Point sphere;
+  vector<ClusterPtr> clusters_nn;
 
-  for(int i = 0; i<laserscans.size() ;i++){
-    vector<ClusterPtr> clusters_nn;
+  getClusters(laserscans[i], &clusters_nn);
 
-    getClusters(laserscans[i], &clusters_nn);
+  LidarClustersPtr cluster (new LidarClusters);
+  cluster->Clusters = clusters_nn;
+  clusters[i] = cluster;
 
-    LidarClustersPtr cluster (new LidarClusters);
-    cluster->Clusters = clusters_nn;
-    clusters.push_back(cluster);
-//    ROS_INFO("%d",clusters_nn.size());
-
-    LidarClustersPtr circlePs (new LidarClusters);
-    vector<ClusterPtr> circleP;
-    double r;
-    r=find_circle(clusters_nn,circleP,i);
-    int num;
-    if(r!=0)
-      num++;
+  LidarClustersPtr circlePs (new LidarClusters);
+  vector<ClusterPtr> circleP;
+  radius[i]=find_circle(clusters_nn,circleP,i,center[i]);
+  circlePs->Clusters = circleP;
+  circlePoints[i] = circlePs;
+}
 
-    radius.push_back(r);
-    circlePs->Clusters = circleP;
-    circlePoints.push_back(circlePs);
+/**
+   @brief Handler for the incoming data
+   @param[in] laserscans points of the used rings
+   @param[in] stamp acquisition time of the scan, copied into the published centroid
+   @return void
+ */
+void velodyne_findBall(const vector< vector<PointPtr> > &laserscans, const ros::Time &stamp)
+{
+  int rings = laserscans.size();
+  vector<LidarClustersPtr> clusters(rings);
+  vector<LidarClustersPtr> circlePoints(rings);
+  vector<double> radius(rings, 0);
+  vector<geometry_msgs::Point> center(rings);
+  Point sphere;
 
+  if(rings==0)
+    return;
 
-    /*--------Publish Circle Centroid--------*/
-    center.push_back(sphereCentroid.point);
+  // The rings are independent until the centroid fusion, each one writes only its own slot
+  ring_pool->run(rings, boost::bind(findRingCircle, _1, boost::cref(laserscans), boost::ref(clusters),
+                                    boost::ref(circlePoints), boost::ref(radius), boost::ref(center)));
 
-    int circlesNumb = 0;
-    if(i==laserscans.size()-1)
-    {
-      for(int j=0; j<laserscans.size(); j++)
-      {
-        if(radius[j]>0.001)
-          circlesNumb++;
-      }
+  /*--------Publish Circle Centroid--------*/
+  int circlesNumb = 0;
+  for(int j=0; j<rings; j++)
+  {
+    if(radius[j]>0.001)
+      circlesNumb++;
+  }
 
-      if(circlesNumb>1)
-      {
-        calculateSphereCentroid(center, sphereCentroid, radius);
-        sphere.x=sphereCentroid.point.x;
-        sphere.y=sphereCentroid.point.y;
-        sphere.z=sphereCentroid.point.z;
-      }
-      else
-      {
-        sphere.x=-100;
-        sphere.y=0;
-        sphere.z=0;
-      }
-      sphereCentroid.header.stamp = ros::Time::now();
-      sphereCentroid_pub.publish(sphereCentroid);
-    }    
+  if(circlesNumb>1)
+  {
+    calculateSphereCentroid(center, sphereCentroid, radius);
+    sphere.x=sphereCentroid.point.x;
+    sphere.y=sphereCentroid.point.y;
+    sphere.z=sphereCentroid.point.z;
+  }
+  else
+  {
+    sphereCentroid.point=center[rings-1];
+    sphere.x=-100;
+    sphere.y=0;
+    sphere.z=0;
   }
+  sphereCentroid.header.stamp = stamp;
+  sphereCentroid_pub.publish(sphereCentroid);
 
   /*---------Vizualize the Segmentation Results---------*/
-  visualization_msgs::MarkerArray targets_markers;
-  targets_markers.markers = createTargetMarkers(clusters,circlePoints, sphere,radius);
-
-  velodyne_pub.publish(targets_markers);
+  velodyne_pub.publish(createTargetMarkers(clusters,circlePoints, sphere,radius));
 
 } //end function
 
@@ -376,149 +390,53 @@ double pointsDist(geometry_msgs::Point center1, geometry_msgs::Point center3){
    @brief Find circle on laser data
    @param[in] clusters segmented scan from the laser
    @param[out] circleP point coordinates of the circle detected for representation on rviz
-   @param[in] layer number of the scan
+   @param[in] ring number of the ring
+   @param[out] center centre of the detected circle, -999 if none was found
    @return double radius of the detected circle
  */
-double find_circle(vector<ClusterPtr> clusters, vector<ClusterPtr>& circleP, int ring)
+double find_circle(vector<ClusterPtr> clusters, vector<ClusterPtr>& circleP, int ring, geometry_msgs::Point& center)
 {
   int count=0;
   double radius=0;
-  bool checkCircle = false;
+  center.x=-999;
+  center.y=-999;
+  center.z=-999;
   double Angle;
   if(ring<8){
     Angle = (((double)(ring)*30/16)-15);
   }else{
     Angle = (((double)(ring+1)*30/16)-15);
   }
-  //cout << "Angle = " << Angle << endl;
+
+  //if (m>90 && m<135 && std < 8.6)
+  //if (m>90 && m<145 && std < 12) // ATLASCAR
+  CircleDetector detector(10, 90, 135, 8.5, 1.2*BALL_DIAMETER);
+
   for(int k=0; k<clusters.size(); k++)
   {
     ClusterPtr cluster=clusters[k];
-    int segment_init, segment_end;
-    for (int i=0; i<cluster->support_points.size(); i++)
-    {
-
-      segment_init=0;
-      segment_end=cluster->support_points.size()-1;
-
-      // Detect if at least 6 points
-      double angle[1000];
-      double vecA[3],vecB[3];
-      int n=0;
-      if (segment_end-segment_init>=10)
-      {
-        for (int j=segment_init+1; j<segment_end-1; j++)
-        {
-          // use 3D but actually Z = 0 because laserscan is planar
-          vecA[0] = cluster->support_points[segment_init]->x - cluster->support_points[j]->x;
-          vecA[1] = cluster->support_points[segment_init]->y - cluster->support_points[j]->y;
-          vecA[2] = cluster->support_points[segment_init]->z - cluster->support_points[j]->z;
-
-          vecB[0] = cluster->support_points[segment_end]->x - cluster->support_points[j]->x;
-          vecB[1] = cluster->support_points[segment_end]->y - cluster->support_points[j]->y;
-          vecB[2] = cluster->support_points[segment_end]->z - cluster->support_points[j]->z;
-
-          angle[n] = acos( inner_product(vecA, vecA+3, vecB, 0.0)
-                           / (sqrt(pow(vecA[0],2) + pow(vecA[1],2) + pow(vecA[2],2)) * sqrt(pow(vecB[0],2) + pow(vecB[1],2) + pow(vecB[2],2))));
-          n++;
-        }
-        // compute average angle and std
-        double m=0;
-        double std=0;
 
-        for (int j = 0; j < n; j++)
-          m += angle[j];
+    Point centroid;
+    double R;
+    if(!detector.detect(cluster, Angle, R, centroid))
+      continue;
 
-        m = m/n;
-        for ( int j = 0; j < n; j++ )
-        {
-          std += pow((angle[j]-m),2);
-        }
+    radius=R;
 
-        std = sqrt(std/(n-1));
-
-        // conversion to degree
-        m = m/M_PI*180;
-        std = std/M_PI*180;
-
-        //if (m>90 && m<135 && std < 8.6)
-        //if (m>90 && m<145 && std < 12) // ATLASCAR
-        if (m>90 && m<135 && std < 8.5)
-        {
-          // std::cout << "std = " << std << std::endl;
-          // std::cout << "m = " << m << std::endl;
-          double ma,mb,cx,x1,x2,x3,cy,y1,y2,y3,z1,z2,z3;
-          x1=cluster->support_points[segment_init]->x;
-          x2=cluster->support_points[round(segment_end/2)]->x;
-          x3=cluster->support_points[segment_end]->x;
-          y1=cluster->support_points[segment_init]->y;
-          y2=cluster->support_points[round(segment_end/2)]->y;
-          y3=cluster->support_points[segment_end]->y;
-          z1=cluster->support_points[segment_init]->z;
-          z2=cluster->support_points[round(segment_end/2)]->z;
-          z3=cluster->support_points[segment_end]->z;
-
-          //rotate da points to da plane XY
-          for(int i=0; i<cluster->support_points.size(); i++)
-            rotatePoints(cluster->support_points[i]->x,cluster->support_points[i]->y, cluster->support_points[i]->z, Angle);
-
-          Point centroid;
-          double R;
-          CalculateCircle(cluster,R,centroid);
-
-          double z=0;
-          rotatePoints(centroid.x,centroid.y,z,-Angle);
-
-          for(int i=0; i<cluster->support_points.size(); i++)
-            rotatePoints(cluster->support_points[i]->x,cluster->support_points[i]->y, cluster->support_points[i]->z, -Angle);
-
-          rotatePoints(x1,y1, z1, Angle);
-          rotatePoints(x2,y2, z2, Angle);
-          rotatePoints(x3,y3, z3, Angle);
-
-          ma=(y2-y1)/(x2-x1);
-          mb=(y3-y2)/(x3-x2);
-
-          cx=(ma*mb*(y1-y3)+mb*(x1+x2)-ma*(x2+x3))/(2*(mb-ma));
-          cy=-1/ma*(cx-(x1+x2)/2)+(y1+y2)/2;
-
-          radius=sqrt(pow((cx-x1),2) + pow((cy-y1),2));
-          radius=R;
-
-          rotatePoints(cx,cy,z1,-Angle);
-          double circle[3];
-          circle[0]=centroid.x;
-          circle[1]=centroid.y;
-          circle[2]=z;
-
-          double centre[3];
-          centre[0] = circle[0];
-          centre[1] = circle[1];
-          centre[2] = circle[2];
-
-          sphereCentroid.point.x=circle[0];
-          sphereCentroid.point.y=circle[1];
-          sphereCentroid.point.z=circle[2];
-
-          circlePoints(circleP,radius,centre,20);
-          if(!circleP.empty())
-            circleP[count]->centroid=cluster->centroid;
-          count++;
-          checkCircle=true;
-        }
-        else
-        {
-          if(checkCircle==false)
-          {
-            sphereCentroid.point.x=-999;
-            sphereCentroid.point.y=-999;
-            sphereCentroid.point.z=-999;
-          }
-        }
-      }
-    }
+    double centre[3];
+    centre[0] = centroid.x;
+    centre[1] = centroid.y;
+    centre[2] = centroid.z;
+
+    center.x=centre[0];
+    center.y=centre[1];
+    center.z=centre[2];
+
+    circlePoints(circleP,radius,centre,20);
+    if(!circleP.empty())
+      circleP[count]->centroid=cluster->centroid;
+    count++;
   }
-//  cout<<"R "<<radius<<endl;
   return radius;
 }
 
@@ -539,50 +457,27 @@ void rotatePoints(double& x,double& y, double& z, double angle)
 }
 
 /**
-   @brief Detection of the ball on the Kinect data
-   @param[in] Kinect_cloud point cloud from the Kinect
+   @brief Detection of the ball on the Velodyne data
+   @param[in] cloud point cloud without the ground
+   @param[in] fitter sphere fitter, warm started from the previous scan
+   @param[in] stamp acquisition time of the scan, copied into the published centroid
    @return void
  */
-void sphereDetection(pcl::PointCloud<pcl::PointXYZ> Kinect_cloud)
+void sphereDetection(const pcl::PointCloud<pcl::PointXYZ> &cloud, SphereFitter &fitter, const ros::Time &stamp)
 {
-
   geometry_msgs::PointStamped sphereCenter;
   sphereCenter.point.x = -999;
   sphereCenter.point.y = -999;
   sphereCenter.point.z = -999;
 
-  /* METHOD #3 ================================================================
-   * Detects the ball up to 3 meters, fast. Optimized Method #1
-   */
-  pcl::PointCloud<pcl::PointXYZ>::Ptr Kinect_cloudPtr (new pcl::PointCloud<pcl::PointXYZ>(Kinect_cloud));
-
-  pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients ());
-  pcl::PointIndices::Ptr inliers (new pcl::PointIndices ());
-
-  // Create the segmentation object
-  pcl::SACSegmentation<pcl::PointXYZ> seg;
-  // Optional
-  seg.setOptimizeCoefficients (true);
-  // Mandatory
-  seg.setModelType (pcl::SACMODEL_SPHERE);
-  seg.setMethodType (pcl::SAC_RANSAC);
-  seg.setMaxIterations (10000);
-  seg.setDistanceThreshold (0.01); //0.0070936
-  seg.setProbability(0.99);
-  seg.setRadiusLimits (BALL_DIAMETER/2-1, BALL_DIAMETER/2+1);
-  seg.setInputCloud (Kinect_cloudPtr);
-  seg.segment (*inliers, *coefficients);
-
-  if(inliers->indices.size ()>50)
+  SphereFit sphere;
+  if(fitter.fit(cloud, NULL, sphere))
   {
-    if (coefficients->values[3]<BALL_DIAMETER/2 + 0.5*BALL_DIAMETER/2 && coefficients->values[3]>BALL_DIAMETER/2 - 0.5*BALL_DIAMETER/2)
-    {
-      sphereCenter.point.x = coefficients->values[0];
-      sphereCenter.point.y = coefficients->values[1];
-      sphereCenter.point.z = coefficients->values[2];
+    sphereCenter.point.x = sphere.center(0);
+    sphereCenter.point.y = sphere.center(1);
+    sphereCenter.point.z = sphere.center(2);
 
-      cout << "Accepted: " << *coefficients << endl;
-    }
+    cout << "Accepted: " << sphere << endl;
   }
 
   // Ball detection ends here =================================================
@@ -592,7 +487,7 @@ void sphereDetection(pcl::PointCloud<pcl::PointXYZ> Kinect_cloud)
   center.y = sphereCenter.point.y;
   center.z = sphereCenter.point.z;
 
-  sphereCenter.header.stamp = ros::Time::now();
+  sphereCenter.header.stamp = stamp;
   sphereCentroid_pub.publish(sphereCenter);
 
   visualization_msgs::MarkerArray targets_markers;
@@ -602,10 +497,113 @@ void sphereDetection(pcl::PointCloud<pcl::PointXYZ> Kinect_cloud)
 
 
 namespace velodyne {
+/**
+  \class GroundPlane
+  \brief Optional ground removal for the Velodyne detectors. The plane found on the previous revolution is checked
+  against the new cloud and only refined by least squares while it still explains enough points; RANSAC, with a
+  small iteration budget, is run again only when the inlier ratio drops. When disabled nothing is computed.
+ */
+class GroundPlane
+{
+public:
+  GroundPlane() : enabled(false), distance_threshold(0.1), max_iterations(50), min_inlier_ratio(0.8),
+                  valid(false), reference_ratio(0)
+  {
+  }
+
+  /**
+     @brief Reads the ground removal parameters from the private namespace of the node
+     @return void
+   */
+  void readParameters()
+  {
+    NodeHandle nh("~");
+    nh.param("groundRemoval", enabled, false);
+    nh.param("groundDistance", distance_threshold, 0.1);
+    nh.param("groundIterations", max_iterations, 50);
+    nh.param("groundMinInlierRatio", min_inlier_ratio, 0.8);
+    if(enabled)
+      ROS_INFO("Ground removal enabled (distance %.3f m, %d iterations)", distance_threshold, max_iterations);
+  }
+
+  /**
+     @brief Updates the ground plane for a new cloud
+     @param[in] cloud points of the current revolution
+     @return true if a plane is available
+   */
+  bool estimate(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr &cloud)
+  {
+    if(cloud->empty())
+      return false;
+
+    if(valid){
+      pcl::SampleConsensusModelPlane<pcl::PointXYZ> model(cloud);
+      vector<int> inliers;
+      model.selectWithinDistance(coefficients, distance_threshold, inliers);
+
+      double ratio = (double)inliers.size()/cloud->size();
+      if(inliers.size()>=3 && ratio>=min_inlier_ratio*reference_ratio){
+        Eigen::VectorXf refined;
+        model.optimizeModelCoefficients(inliers, coefficients, refined);
+        coefficients = refined;
+        return true;
+      }
+    }
+
+    pcl::ModelCoefficients plane;
+    pcl::PointIndices inliers;
+    pcl::SACSegmentation<pcl::PointXYZ> seg;
+    seg.setOptimizeCoefficients (true);
+    seg.setModelType (pcl::SACMODEL_PLANE);
+    seg.setMethodType (pcl::SAC_RANSAC);
+    seg.setDistanceThreshold (distance_threshold);
+    seg.setMaxIterations (max_iterations);
+    seg.setInputCloud (cloud);
+    seg.segment (inliers, plane);
+
+    valid = inliers.indices.size()>=3 && plane.values.size()==4;
+    if(valid){
+      coefficients = Eigen::Vector4f(plane.values[0], plane.values[1], plane.values[2], plane.values[3]);
+      reference_ratio = (double)inliers.indices.size()/cloud->size();
+    }
+    return valid;
+  }
+
+  bool isGround(double x, double y, double z) const
+  {
+    return valid && fabs(coefficients[0]*x + coefficients[1]*y + coefficients[2]*z + coefficients[3]) <= distance_threshold;
+  }
+
+  bool enabled;
+  double distance_threshold;
+  int max_iterations;
+  double min_inlier_ratio;
+
+private:
+  bool valid;
+  double reference_ratio; // inlier ratio of the last RANSAC estimate
+  Eigen::VectorXf coefficients;
+};
+
+
 class velodyne_BD_RANSAC
 {
 public:
   velodyne_BD_RANSAC(string topicName) {
+    ground.readParameters();
+
+    // Same radius limits and acceptance as the SACSegmentation this replaces
+    ros::NodeHandle nh("~");
+    fitter.radius = BALL_DIAMETER/2;
+    fitter.radius_tolerance = 0.5*BALL_DIAMETER/2;
+    fitter.sample_tolerance = 1;
+    fitter.distance_threshold = 0.01;
+    fitter.min_inliers = 51;
+    fitter.max_iterations = 10000;
+    fitter.time_budget = 0.05;
+    fitter.min_inlier_ratio = 0;
+    fitter.readParameters(nh);
+
     // subscribe to VelodyneScan packets
     velodyne_scan =
       node.subscribe(topicName, 10,
@@ -616,6 +614,8 @@ public:
 private:
   NodeHandle node;
   Subscriber velodyne_scan;
+  GroundPlane ground;
+  SphereFitter fitter;
 
   void processScan(const sensor_msgs::PointCloud2::ConstPtr &scanMsg){
     pcl::PointCloud<pcl::PointXYZ> pclCloud;
@@ -662,32 +662,19 @@ private:
      // apply filter
      condrem.filter (*pcl_filtered2);
 
-    pcl::PointCloud<pcl::PointXYZ>::Ptr pcl_filtered_nground (new pcl::PointCloud<pcl::PointXYZ>);
-
-    pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients);
-    pcl::PointIndices::Ptr inliers (new pcl::PointIndices);
-    // Create the segmentation object
-    pcl::SACSegmentation<pcl::PointXYZ> seg;
-    // Optional
-    seg.setOptimizeCoefficients (true);
-    // Mandatory
-    seg.setModelType (pcl::SACMODEL_PLANE);
-    seg.setMethodType (pcl::SAC_RANSAC);
-    seg.setDistanceThreshold (0.1);
-    seg.setInputCloud (pcl_filtered2);
-    seg.segment (*inliers, *coefficients);
-
-    // Create the filtering object
-    pcl::ExtractIndices<pcl::PointXYZ> extract(false);
-    extract.setInputCloud(pcl_filtered);
-    extract.setIndices(inliers);
-    extract.setNegative(true);
-    extract.filter(*pcl_filtered_nground);
-
-    pcl::PointCloud<pcl::PointXYZ> pcl_clean = *pcl_filtered2;
-
+    pcl::PointCloud<pcl::PointXYZ> pcl_clean;
+    if(ground.enabled && ground.estimate(pcl_filtered2)){
+      pcl_clean.reserve(pcl_filtered2->size());
+      for(size_t i = 0; i<pcl_filtered2->size(); i++){
+        const pcl::PointXYZ &p = pcl_filtered2->points[i];
+        if(!ground.isGround(p.x, p.y, p.z))
+          pcl_clean.push_back(p);
+      }
+    }else{
+      pcl_clean = *pcl_filtered2;
+    }
 
-    sphereDetection(pcl_clean);
+    sphereDetection(pcl_clean, fitter, scanMsg->header.stamp);
   }
 };
 
@@ -708,117 +695,167 @@ public:
     for(int i = 0; i<8;i++){
       used_planes[i]=1;
     }
+
+    ring_slot.assign(16, -1);
+    n_used_rings = 0;
+    for(int i = 0; i<16;i++){
+      if(used_planes[i]==1)
+        ring_slot[i] = n_used_rings++;
+    }
+    ring_points.resize(16);
+    ring_size.assign(16, 0);
+
+    ground.readParameters();
+    ground_cloud.reset(new pcl::PointCloud<pcl::PointXYZ>);
   }
 
+  /**
+     @brief Splits a VLP-16 revolution into one vector of points per used ring. x, y, z and ring are read straight
+     from the PointCloud2 buffer and the region of interest (0 <= x <= 30 outside the +-0.8 m square around the
+     sensor) is tested inline, so the whole revolution is handled in a single pass. The Point objects are kept
+     per ring and reused on the next revolution, new ones are only allocated when a ring grows.
+     @param[in] pcl2 point cloud from the velodyne driver, with a ring field
+     @param[out] laserscan points of every used ring, in ring order
+     @return void
+   */
   void pcl2ToLaserPoints(const sensor_msgs::PointCloud2::ConstPtr &pcl2, vector< vector<PointPtr> > &laserscan){
-    vector<PointPtr> scanPtr;
-    laserscan.assign(16, scanPtr);
-
-    pcl::PointCloud<VPoint> pcl;
-    pcl::fromROSMsg(*pcl2, pcl);
+    int offset_x = -1, offset_y = -1, offset_z = -1, offset_ring = -1;
+    uint8_t ring_type = 0;
+
+    for(size_t f = 0; f<pcl2->fields.size(); f++){
+      const sensor_msgs::PointField &field = pcl2->fields[f];
+      if(field.name == "x" && field.datatype == sensor_msgs::PointField::FLOAT32)
+        offset_x = field.offset;
+      else if(field.name == "y" && field.datatype == sensor_msgs::PointField::FLOAT32)
+        offset_y = field.offset;
+      else if(field.name == "z" && field.datatype == sensor_msgs::PointField::FLOAT32)
+        offset_z = field.offset;
+      else if(field.name == "ring"){
+        offset_ring = field.offset;
+        ring_type = field.datatype;
+      }
+    }
 
-    pcl::PointCloud<pcl::PointXYZI> pcl_xyz;
-    pcl::copyPointCloud(pcl, pcl_xyz);
-    for(int i = 0; i<pcl.size();i++){
-      pcl_xyz[i].intensity = pcl[i].ring;
+    laserscan.resize(n_used_rings);
+    if(offset_x<0 || offset_y<0 || offset_z<0 || offset_ring<0){
+      ROS_WARN_THROTTLE(5, "Velodyne cloud needs float x, y, z and a ring field");
+      for(int r = 0; r<n_used_rings; r++)
+        laserscan[r].clear();
+      return;
     }
 
-    pcl::PointCloud<pcl::PointXYZI>::Ptr pcl_Ptr (new pcl::PointCloud<pcl::PointXYZI>(pcl_xyz));
-    pcl::PointCloud<pcl::PointXYZI>::Ptr pcl_filtered (new pcl::PointCloud<pcl::PointXYZI>);
+    ring_size.assign(16, 0);
 
-    pcl::PassThrough<pcl::PointXYZI> x_filter;
-    x_filter.setInputCloud(pcl_Ptr);
-    x_filter.setFilterFieldName("x");
-    x_filter.setFilterLimits(0,30);
-    x_filter.filter(*pcl_filtered);
+    for(uint32_t row = 0; row<pcl2->height; row++){
+      const uint8_t *ptr = &pcl2->data[row*pcl2->row_step];
 
-     // Build the condition
-    pcl::ConditionOr<pcl::PointXYZI>::Ptr range_and1 (new pcl::ConditionOr<pcl::PointXYZI> ());
-    range_and1->addComparison (pcl::FieldComparison<pcl::PointXYZI>::Ptr (new pcl::FieldComparison<pcl::PointXYZI>("y", pcl::ComparisonOps::GT, 0.8)));
-    range_and1->addComparison (pcl::FieldComparison<pcl::PointXYZI>::Ptr (new pcl::FieldComparison<pcl::PointXYZI>("x", pcl::ComparisonOps::GT, 0.8)));
+      for(uint32_t col = 0; col<pcl2->width; col++, ptr += pcl2->point_step){
+        float x, y, z;
+        memcpy(&x, ptr + offset_x, sizeof(float));
+        memcpy(&y, ptr + offset_y, sizeof(float));
 
-    pcl::ConditionOr<pcl::PointXYZI>::Ptr range_and2 (new pcl::ConditionOr<pcl::PointXYZI> ());
-    range_and2->addComparison (pcl::FieldComparison<pcl::PointXYZI>::Ptr (new pcl::FieldComparison<pcl::PointXYZI>("y", pcl::ComparisonOps::LT, -0.8)));
-    range_and2->addComparison (pcl::FieldComparison<pcl::PointXYZI>::Ptr (new pcl::FieldComparison<pcl::PointXYZI>("x", pcl::ComparisonOps::LT, -0.8)));
+        // x in [0, 30] and outside the dead zone around the sensor (also rejects NaN)
+        if(!(x >= 0 && x <= 30))
+          continue;
+        if(!(x > 0.8 || x < -0.8 || y > 0.8 || y < -0.8))
+          continue;
 
-    pcl::ConditionOr<pcl::PointXYZI>::Ptr range_and3 (new pcl::ConditionOr<pcl::PointXYZI> ());
-    range_and3->addComparison (pcl::FieldComparison<pcl::PointXYZI>::Ptr (new pcl::FieldComparison<pcl::PointXYZI>("y", pcl::ComparisonOps::GT, 0.8)));
-    range_and3->addComparison (pcl::FieldComparison<pcl::PointXYZI>::Ptr (new pcl::FieldComparison<pcl::PointXYZI>("x", pcl::ComparisonOps::LT, -0.8)));
+        int ring = readRing(ptr + offset_ring, ring_type);
+        if(ring<0 || ring>=16 || ring_slot[ring]<0)
+          continue;
 
-    pcl::ConditionOr<pcl::PointXYZI>::Ptr range_and4 (new pcl::ConditionOr<pcl::PointXYZI> ());
-    range_and4->addComparison (pcl::FieldComparison<pcl::PointXYZI>::Ptr (new pcl::FieldComparison<pcl::PointXYZI>("y", pcl::ComparisonOps::LT, -0.8)));
-    range_and4->addComparison (pcl::FieldComparison<pcl::PointXYZI>::Ptr (new pcl::FieldComparison<pcl::PointXYZI>("x", pcl::ComparisonOps::GT, 0.8)));
+        memcpy(&z, ptr + offset_z, sizeof(float));
 
-    pcl::ConditionOr<pcl::PointXYZI>::Ptr range (new pcl::ConditionOr<pcl::PointXYZI> ());
-    range->addCondition (range_and1);
-    range->addCondition (range_and2);
-    range->addCondition (range_and3);
-    range->addCondition (range_and4);
+        vector<PointPtr> &pool = ring_points[ring];
+        if(ring_size[ring] == pool.size())
+          pool.push_back(PointPtr(new Point));
 
-    pcl::PointCloud<pcl::PointXYZI>::Ptr pcl_filtered2 (new pcl::PointCloud<pcl::PointXYZI>);
-    // Build the filter
-     pcl::ConditionalRemoval<pcl::PointXYZI> condrem(true);
-     condrem.setCondition (range);
-     condrem.setInputCloud (pcl_filtered);
-//     condrem.setKeepOrganized(true);
-     // apply filter
-     condrem.filter (*pcl_filtered2);
+        Point &point = *pool[ring_size[ring]++];
+        point = Point();
+        point.x = x;
+        point.y = y;
+        point.z = z;
+      }
+    }
 
-    pcl::PointCloud<pcl::PointXYZI>::Ptr pcl_filtered_nground (new pcl::PointCloud<pcl::PointXYZI>);
+    if(ground.enabled)
+      removeGround();
 
-    pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients);
-    pcl::PointIndices::Ptr inliers (new pcl::PointIndices);
-    // Create the segmentation object
-    pcl::SACSegmentation<pcl::PointXYZI> seg;
-    // Optional
-    seg.setOptimizeCoefficients (true);
-    // Mandatory
-    seg.setModelType (pcl::SACMODEL_PLANE);
-    seg.setMethodType (pcl::SAC_RANSAC);
-    seg.setDistanceThreshold (0.1);
-    seg.setInputCloud (pcl_filtered2);
-    seg.segment (*inliers, *coefficients);
-
-    // Create the filtering object
-    pcl::ExtractIndices<pcl::PointXYZI> extract(false);
-    extract.setInputCloud(pcl_filtered);
-    extract.setIndices(inliers);
-    extract.setNegative(true);
-    extract.filter(*pcl_filtered_nground);
-
-    pcl::PointCloud<pcl::PointXYZI> pcl_clean = *pcl_filtered2;
-
-    for(int i = 0; i<pcl_clean.size();i++){
-      pcl::PointXYZI point = pcl_clean.at(i);
-      int ringNumber = point.intensity;
-//      ROS_INFO("%d",ringNumber);
-      PointPtr pointXYZ(new Point);
-      pointXYZ->x = point.x;
-      pointXYZ->y = point.y;
-      pointXYZ->z = point.z;
-
-      laserscan[ringNumber].push_back(pointXYZ);
+    for(int r = 0; r<16; r++){
+      if(ring_slot[r]>=0)
+        laserscan[ring_slot[r]].assign(ring_points[r].begin(), ring_points[r].begin() + ring_size[r]);
     }
-//    ROS_INFO("Points: %d",laserscans[0].size());
   }
 
   void processScan(const sensor_msgs::PointCloud2::ConstPtr &scanMsg){
     pcl2ToLaserPoints(scanMsg, laserscans);
-    vector< vector<PointPtr> > laserscans_clean;
-    for(int i = 0; i<laserscans.size();i++){
-      if(used_planes[i]==1){
-        laserscans_clean.push_back(laserscans[i]);
+    velodyne_findBall(laserscans, scanMsg->header.stamp);
+  }
+
+private:
+  /**
+     @brief Removes the points of the ground plane from the ring pools, keeping the removed Point objects for reuse
+     @return void
+   */
+  void removeGround(){
+    ground_cloud->clear();
+    for(int r = 0; r<16; r++){
+      for(size_t k = 0; k<ring_size[r]; k++){
+        const Point &point = *ring_points[r][k];
+        ground_cloud->push_back(pcl::PointXYZ(point.x, point.y, point.z));
       }
     }
 
-    velodyne_findBall(laserscans_clean);
+    if(!ground.estimate(ground_cloud))
+      return;
+
+    for(int r = 0; r<16; r++){
+      vector<PointPtr> &pool = ring_points[r];
+      size_t kept = 0;
+      for(size_t k = 0; k<ring_size[r]; k++){
+        if(!ground.isGround(pool[k]->x, pool[k]->y, pool[k]->z))
+          swap(pool[kept++], pool[k]);
+      }
+      ring_size[r] = kept;
+    }
+  }
+
+  static int readRing(const uint8_t *ptr, uint8_t datatype){
+    switch(datatype){
+      case sensor_msgs::PointField::UINT8:{
+        return *ptr;
+      }
+      case sensor_msgs::PointField::UINT16:{
+        uint16_t ring;
+        memcpy(&ring, ptr, sizeof(ring));
+        return ring;
+      }
+      case sensor_msgs::PointField::INT32:
+      case sensor_msgs::PointField::UINT32:{
+        int32_t ring;
+        memcpy(&ring, ptr, sizeof(ring));
+        return ring;
+      }
+      case sensor_msgs::PointField::FLOAT32:{
+        float ring;
+        memcpy(&ring, ptr, sizeof(ring));
+        return (int)ring;
+      }
+      default:
+        return -1;
+    }
   }
 
-private:
   NodeHandle node;
   Subscriber velodyne_scan;
   vector< vector<PointPtr> > laserscans;
   vector<int> used_planes;
+  vector<int> ring_slot; // position of each ring in laserscans, -1 if not used
+  int n_used_rings;
+  vector< vector<PointPtr> > ring_points; // reused Point objects of each ring
+  vector<size_t> ring_size;
+  GroundPlane ground;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr ground_cloud;
 };
 }
 
@@ -837,6 +874,12 @@ int main(int argc, char **argv)
   cout << "Node namespace:" << node_ns << endl;
   cout << "Ball diameter:" << BALL_DIAMETER << endl;
 
+  // The calling thread works on one ring too, so the default leaves one core to it
+  int ringThreads;
+  nh.param("ringThreads", ringThreads, max((int)boost::thread::hardware_concurrency()-1, 0));
+  cout << "Ring threads:" << ringThreads << endl;
+  ring_pool.reset(new WorkerPool(ringThreads));
+
   velodyne_pub = nh.advertise<visualization_msgs::MarkerArray>( "BallDetection", 10000);
   sphereCentroid_pub = nh.advertise<geometry_msgs::PointStamped>("SphereCentroid",1000);
 
@@ -38,6 +38,7 @@
 #include <lidar_segmentation/clustering.h>
 #include "calibration_gui/common_functions.h"
 #include "calibration_gui/visualization_rviz_velodyne.h"
+#include "calibration_gui/layer_markers.h"
 #include <visualization_msgs/Marker.h>
 #include <algorithm>
 #include <iterator>
@@ -45,335 +46,130 @@
 #include <vector>
 
 
+// Marker families of the VLP-16, one marker per ring for the layered ones
+enum { IDS_SCAN, IDS_CIRCLE, IDS_SPHERE, CLUSTERS_SCAN, CLUSTERS_CIRCLE, SPHERE };
+
+/**
+@brief Families of the VLP-16 markers
+@param[out] markers builder to set up
+@return void
+*/
+static void addFamilies(LayerMarkers& markers)
+{
+    std_msgs::ColorRGBA white;
+    white.r=1.0; white.g=1.0; white.b=1.0; white.a=1.0;
+    std_msgs::ColorRGBA none;
+
+    markers.addFamily("ids_scan", visualization_msgs::Marker::TEXT_VIEW_FACING, 0.1, white);
+    markers.addFamily("ids_circle", visualization_msgs::Marker::TEXT_VIEW_FACING, 0.1, white);
+    markers.addFamily("ids_sphere", visualization_msgs::Marker::TEXT_VIEW_FACING, 0.1, white, false);
+    markers.addFamily("clusters_scan", visualization_msgs::Marker::POINTS, 0.08, white);
+    markers.addFamily("clusters_circle", visualization_msgs::Marker::LINE_LIST, 0.03, none);
+    markers.addFamily("sphere", visualization_msgs::Marker::SPHERE_LIST, 0.8, white, false);
+}
+
 /**
 @brief Markers publication for the visualization of the laser scans, circle detected and ball detected
 @param[in] sickLidarClusters_nn segmentatio of the several laser scans
 @param[in] circlePoints points for the representation of the detected circles
 @param[in] sphere center coordinates of the ball
 @param[in] radius radius of the circles detected
-@return vector<visualization_msgs::Marker>
+@return const visualization_msgs::MarkerArray& markers of the scan, valid until the next call
 */
-vector<visualization_msgs::Marker> createTargetMarkers(vector<LidarClustersPtr>& sickLidarClusters_nn, vector<LidarClustersPtr>& circlePoints, Point sphere, vector<double> radius )
+const visualization_msgs::MarkerArray& createTargetMarkers(vector<LidarClustersPtr>& sickLidarClusters_nn, vector<LidarClustersPtr>& circlePoints, Point sphere, vector<double> radius )
 {
-    static Markers marker_list;
-
-    //Reduce the elements status, ADD to REMOVE and REMOVE to delete
-    marker_list.decrement();
+    static LayerMarkers markers("/velodyne");
+    if(markers.families()==0)
+        addFamilies(markers);
 
     // Create a colormap
-    class_colormap colormap("hsv",10, 1, false);
-
-    vector<visualization_msgs::Marker> marker_ids_scan;
-    vector<visualization_msgs::Marker> marker_ids_circle;
-
-    visualization_msgs::Marker marker_ids_sphere;
-    marker_ids_sphere.header.frame_id = "/velodyne";
-    marker_ids_sphere.header.stamp = ros::Time::now();
-    marker_ids_sphere.ns = "ids_sphere";
-    marker_ids_sphere.action = visualization_msgs::Marker::ADD;
-    marker_ids_sphere.type = visualization_msgs::Marker::TEXT_VIEW_FACING;
-    marker_ids_sphere.scale.x = 0.1;
-    marker_ids_sphere.scale.y = 0.1;
-    marker_ids_sphere.scale.z = 0.1;
-    marker_ids_sphere.color.a = 1.0;
-    marker_ids_sphere.color.r = 1.0;
-    marker_ids_sphere.color.g = 1.0;
-    marker_ids_sphere.color.b = 1.0;
-
-    vector<visualization_msgs::Marker> marker_clusters_scan;
-    vector<visualization_msgs::Marker> marker_clusters_circle;
-
-    visualization_msgs::Marker marker_sphere;
-    marker_sphere.header.frame_id = "/velodyne";
-    marker_sphere.header.stamp = marker_sphere.header.stamp;
-    marker_sphere.ns = "sphere";
-    marker_sphere.action = visualization_msgs::Marker::ADD;
-    marker_sphere.type = visualization_msgs::Marker::SPHERE_LIST;
-    marker_sphere.scale.x = 0.8;
-    marker_sphere.scale.y = 0.8;
-    marker_sphere.scale.z = 0.8;
-
-    for(int i = 0; i<sickLidarClusters_nn.size(); i++){
-      visualization_msgs::Marker marker_id_scan;
-      marker_ids_scan.push_back(marker_id_scan);
-
-      visualization_msgs::Marker marker_id_circle;
-      marker_ids_circle.push_back(marker_id_circle);
-
-      visualization_msgs::Marker marker_cluster_scan;
-      marker_clusters_scan.push_back(marker_cluster_scan);
-
-      visualization_msgs::Marker marker_cluster_circle;
-      marker_clusters_circle.push_back(marker_cluster_circle);
-
-      marker_ids_scan[i].header.frame_id = "/velodyne";
-      marker_ids_scan[i].header.stamp = ros::Time::now();
-
-      marker_ids_circle[i].header.frame_id = "/velodyne";
-      marker_ids_circle[i].header.stamp = ros::Time::now();
-
-      marker_clusters_scan[i].header.frame_id = "/velodyne";
-      marker_clusters_scan[i].header.stamp = marker_clusters_scan[i].header.stamp;
-
-      marker_clusters_circle[i].header.frame_id = "/velodyne";
-      marker_clusters_circle[i].header.stamp = marker_clusters_circle[i].header.stamp;
-
-      marker_ids_scan[i].ns = "ids_scan"+i;
-      marker_ids_scan[i].action = visualization_msgs::Marker::ADD;
-
-      marker_ids_circle[i].ns = "ids_circle"+i;
-      marker_ids_circle[i].action = visualization_msgs::Marker::ADD;
-
-      marker_clusters_scan[i].ns = "clusters_scan"+i;
-      marker_clusters_scan[i].action = visualization_msgs::Marker::ADD;
+    static class_colormap colormap("hsv",10, 1, false);
 
-      marker_clusters_circle[i].ns = "clusters_circle"+i;
-      marker_clusters_circle[i].action = visualization_msgs::Marker::ADD;
+    int rings = sickLidarClusters_nn.size();
+    markers.begin(rings);
 
-      marker_ids_scan[i].type = visualization_msgs::Marker::TEXT_VIEW_FACING;
-      marker_ids_circle[i].type = visualization_msgs::Marker::TEXT_VIEW_FACING;
-
-      marker_clusters_scan[i].type = visualization_msgs::Marker::SPHERE_LIST;
-      marker_clusters_circle[i].type = visualization_msgs::Marker::LINE_STRIP;
-
-      marker_ids_scan[i].scale.x = 0.1;
-      marker_ids_scan[i].scale.y = 0.1;
-      marker_ids_scan[i].scale.z = 0.1;
-      marker_ids_circle[i].scale.x = 0.1;
-      marker_ids_circle[i].scale.y = 0.1;
-      marker_ids_circle[i].scale.z = 0.1;
-      marker_clusters_scan[i].scale.x = 0.08;
-      marker_clusters_scan[i].scale.y = 0.08;
-      marker_clusters_scan[i].scale.z = 0.08;
-      marker_clusters_circle[i].scale.x = 0.03;
+    for(int j=0; j<rings; j++)
+    {
+        //Cluster from ring j
+        const vector<ClusterPtr>& clusters_scan = sickLidarClusters_nn[j]->Clusters;
+        visualization_msgs::Marker& scan = markers.marker(CLUSTERS_SCAN, j);
 
-      marker_ids_scan[i].color.a = 1.0;
-      marker_ids_scan[i].color.r = 1.0;
-      marker_ids_scan[i].color.g = 1.0;
-      marker_ids_scan[i].color.b = 1.0;
-      marker_ids_circle[i].color.a = 1.0;
-      marker_ids_circle[i].color.r = 1.0;
-      marker_ids_circle[i].color.g = 1.0;
-      marker_ids_circle[i].color.b = 1.0;
-    }
+        uint total=0;
+        for(uint i=0; i<clusters_scan.size(); i++)
+            total+=clusters_scan[i]->support_points.size();
+        scan.points.reserve(total);
+        scan.colors.reserve(total);
 
-    vector<double>::iterator max = max_element(radius.begin(),radius.end());
-    int id1 = distance(radius.begin(),max);
-    radius[id1]=0;
-    max = max_element(radius.begin(),radius.end());
-    int id2 = distance(radius.begin(),max);
-    radius[id2]=0;
-    max = max_element(radius.begin(),radius.end());
-    int id3 = distance(radius.begin(),max);
-    radius[id3]=0;
-    max = max_element(radius.begin(),radius.end());
-    int id4 = distance(radius.begin(),max);
-
-//    //green
-//    if(id1==0)
-//    {
-//        marker_clusters_circle0.color.g=1.0f;
-//        marker_clusters_circle0.color.a=1.0;
-//    }
-//    else if(id1==1)
-//    {
-//        marker_clusters_circle1.color.g=1.0f;
-//        marker_clusters_circle1.color.a=1.0;
-//    }
-//    else if(id1==2)
-//    {
-//        marker_clusters_circle2.color.g=1.0f;
-//        marker_clusters_circle2.color.a=1.0;
-//    }
-//    else if(id1==3)
-//    {
-//        marker_clusters_circle3.color.g=1.0f;
-//        marker_clusters_circle3.color.a=1.0;
-//    }
-
-//    //blue
-//    if(id2==0)
-//    {
-//        marker_clusters_circle0.color.b=1.0;
-//        marker_clusters_circle0.color.a=1.0;
-//    }
-//    else if(id2==1)
-//    {
-//        marker_clusters_circle1.color.b=1.0;
-//        marker_clusters_circle1.color.a=1.0;
-//    }
-//    else if(id2==2)
-//    {
-//        marker_clusters_circle2.color.b=1.0;
-//        marker_clusters_circle2.color.a=1.0;
-//    }
-//    else if(id2==3)
-//    {
-//        marker_clusters_circle3.color.b=1.0;
-//        marker_clusters_circle3.color.a=1.0;
-//    }
-
-//    //yellow
-//    if(id3==0)
-//    {
-//        marker_clusters_circle0.color.r=1.0;
-//        marker_clusters_circle0.color.g=1.0;
-//        marker_clusters_circle0.color.a=1.0;
-//    }
-//    else if(id3==1)
-//    {
-//        marker_clusters_circle1.color.r=1.0;
-//        marker_clusters_circle1.color.g=1.0;
-//        marker_clusters_circle1.color.a=1.0;
-//    }
-//    else if(id3==2)
-//    {
-//        marker_clusters_circle2.color.r=1.0;
-//        marker_clusters_circle2.color.g=1.0;
-//        marker_clusters_circle2.color.a=1.0;
-//    }
-//    else if(id3==3)
-//    {
-//        marker_clusters_circle3.color.r=1.0;
-//        marker_clusters_circle3.color.g=1.0;
-//        marker_clusters_circle3.color.a=1.0;
-//    }
-
-//    //red
-//    if(id4==0)
-//    {
-//        marker_clusters_circle0.color.r=1.0;
-//        marker_clusters_circle0.color.a=1.0;
-//    }
-//    else if(id4==1)
-//    {
-//        marker_clusters_circle1.color.r=1.0;
-//        marker_clusters_circle1.color.a=1.0;
-//    }
-//    else if(id4==2)
-//    {
-//        marker_clusters_circle2.color.r=1.0;
-//        marker_clusters_circle2.color.a=1.0;
-//    }
-//    else if(id4==3)
-//    {
-//        marker_clusters_circle3.color.r=1.0;
-//        marker_clusters_circle3.color.a=1.0;
-//    }
-
-    for(int j = 0; j<sickLidarClusters_nn.size(); j++){
-      //Cluster from scan
-      vector<ClusterPtr> clusters_scan0 = sickLidarClusters_nn[j]->Clusters;
-
-      for ( uint i = 0; i<  clusters_scan0.size() ; i++)
-      {
-        ClusterPtr cluster_nn = clusters_scan0[i];
-
-        std_msgs::ColorRGBA color = colormap.color(i);
-
-        //Place in the marker every point belonging to the cluster "i"
-        for(uint h=0;h<cluster_nn->support_points.size();h++)
+        for(uint i=0; i<clusters_scan.size(); i++)
         {
-          geometry_msgs::Point pt;
-          pt.x=cluster_nn->support_points[h]->x;
-          pt.y=cluster_nn->support_points[h]->y;
-          pt.z=cluster_nn->support_points[h]->z;
-          //cout<<"z "<<pt.z<<endl;
-
-          marker_clusters_scan[j].points.push_back(pt);
-          marker_clusters_scan[j].colors.push_back(color);
+            const ClusterPtr& cluster_nn = clusters_scan[i];
+            std_msgs::ColorRGBA color = colormap.color(i);
+
+            //Place in the marker every point belonging to the cluster "i"
+            for(uint h=0; h<cluster_nn->support_points.size(); h++)
+            {
+                geometry_msgs::Point pt;
+                pt.x=cluster_nn->support_points[h]->x;
+                pt.y=cluster_nn->support_points[h]->y;
+                pt.z=cluster_nn->support_points[h]->z;
+                scan.points.push_back(pt);
+                scan.colors.push_back(color);
+            }
+
+            markers.addLabel(IDS_SCAN, j, cluster_nn->id, cluster_nn->centroid->x, cluster_nn->centroid->y, 5, cluster_nn->id);
         }
 
-        marker_ids_scan[j].pose.position.x = cluster_nn->centroid->x;
-        marker_ids_scan[j].pose.position.y = cluster_nn->centroid->y;
-        marker_ids_scan[j].pose.position.z = 5;
+        //circle fit ring j, every segment of the circle is a pair of points of the line list
+        if(j>=circlePoints.size())
+            continue;
 
-        //text
-        boost::format fm("%d");
-        fm % cluster_nn->id;
+        const vector<ClusterPtr>& circles_scan = circlePoints[j]->Clusters;
+        visualization_msgs::Marker& circle = markers.marker(CLUSTERS_CIRCLE, j);
 
-        marker_ids_scan[j].text = fm.str();
-        marker_ids_scan[j].id = cluster_nn->id;
-
-        marker_list.update(marker_ids_scan[j]);
-        marker_list.update(marker_clusters_scan[j]);
-
-      } //end for
-    }
+        total=0;
+        for(uint i=0; i<circles_scan.size(); i++)
+            if(circles_scan[i]->support_points.size()>1)
+                total+=2*(circles_scan[i]->support_points.size()-1);
+        circle.points.reserve(total);
 
-
-    for(int j = 0; j<sickLidarClusters_nn.size(); j++){
-      //circle fit scan0
-
-      vector<ClusterPtr> circles_scan0 = circlePoints[j]->Clusters;
-      for ( uint i = 0; i< circles_scan0.size() ; i++)
-      {
-        ClusterPtr cluster_circle = circles_scan0[i];
-
-        std_msgs::ColorRGBA color = colormap.color(i);
-
-        //Place in the marker every point belonging to the cluster "i"
-        for(uint h=0;h<cluster_circle->support_points.size();h++)
+        for(uint i=0; i<circles_scan.size(); i++)
         {
-          geometry_msgs::Point pt;
-          pt.x=cluster_circle->support_points[h]->x;
-          pt.y=cluster_circle->support_points[h]->y;
-          pt.z= -0.2;
-
-          marker_clusters_circle[j].points.push_back(pt);
-          //marker_clusters_circle[j].colors.push_back(color);
+            const ClusterPtr& cluster_circle = circles_scan[i];
+
+            for(uint h=1; h<cluster_circle->support_points.size(); h++)
+            {
+                geometry_msgs::Point pt;
+                pt.x=cluster_circle->support_points[h-1]->x;
+                pt.y=cluster_circle->support_points[h-1]->y;
+                pt.z=-0.2;
+                circle.points.push_back(pt);
+                pt.x=cluster_circle->support_points[h]->x;
+                pt.y=cluster_circle->support_points[h]->y;
+                circle.points.push_back(pt);
+            }
         }
 
-        marker_ids_circle[j].pose.position.x = cluster_circle->centroid->x;
-        marker_ids_circle[j].pose.position.y = cluster_circle->centroid->y;
-        marker_ids_circle[j].pose.position.z = 1.5;
-
-        //text
-        boost::format fm("%d");
-        fm % 1.0;
-
-        marker_ids_circle[j].text = fm.str();
-        marker_ids_circle[j].id = 1.0;
-
-        marker_list.update(marker_ids_circle[j]);
-        marker_list.update(marker_clusters_circle[j]);
-
-      } //end for
+        //One label per ring, on the last circle
+        if(!circles_scan.empty())
+            markers.addLabel(IDS_CIRCLE, j, 1, circles_scan.back()->centroid->x, circles_scan.back()->centroid->y, 1.5, 1);
     }
 
     //sphere
-
     if(sphere.x!=0)
     {
-        std_msgs::ColorRGBA color = colormap.color(0);
+        visualization_msgs::Marker& marker_sphere = markers.marker(SPHERE);
 
         geometry_msgs::Point pt;
         pt.x=sphere.x;
-        pt.y= sphere.y;
-        pt.z= sphere.z;
+        pt.y=sphere.y;
+        pt.z=sphere.z;
         marker_sphere.points.push_back(pt);
-        marker_sphere.colors.push_back(color);
-
-        marker_ids_sphere.pose.position.x = 0;
-        marker_ids_sphere.pose.position.y = 0;
-        marker_ids_sphere.pose.position.z = 0;
-
-        //text
-        boost::format fm("%d");
-        fm % 1.0;
-
-        marker_ids_sphere.text = fm.str();
-        marker_ids_sphere.id = 1.0;
+        marker_sphere.colors.push_back(colormap.color(0));
 
-        marker_list.update(marker_ids_sphere);
-        marker_list.update(marker_sphere);
+        markers.addLabel(IDS_SPHERE, 0, 1, 0, 0, 0, 1);
     }
 
-    //Remove markers that should not be transmitted
-    marker_list.clean();
-
-    //Clean the marker_vector and put new markers in it;
-    return marker_list.getOutgoingMarkers();
+    return markers.end();
 
 } //end function
 